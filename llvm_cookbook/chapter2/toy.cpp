@@ -1,12 +1,15 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <climits>
 
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Value.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
 
 enum Token_Type
 {
@@ -19,65 +22,75 @@ enum Token_Type
 
 // store the value of numeric tokens
 static int Numeric_Val;
+// 整数常量超出 int 的范围，词法分析器已经报告，numeric_parser 据此拒绝
+static bool Numeric_Out_Of_Range;
 
-static std::string Identifier_string;
+// 标识符直接指向输入缓冲区，不再逐字符拷贝
+static llvm::StringRef Identifier_string;
 
-FILE *file;
+// 整个输入文件通过 MemoryBuffer 读入（大文件使用 mmap），词法分析直接在缓冲区上进行。
+// MemoryBuffer 保证缓冲区以 '\0' 结尾，内层循环因此不需要检查边界。
+static std::unique_ptr<llvm::MemoryBuffer> Input_Buffer;
+static const char *Cur_Ptr;
+static const char *Buffer_End;
 
 static int get_token()
 {
-    static int LastChar = ' '; // Placeholder value for first character
-
-    while (isspace(LastChar))
+    while (1)
     {
-        LastChar = fgetc(file);
-    }
+        while (llvm::isSpace(*Cur_Ptr))
+            ++Cur_Ptr;
 
-    if (isalpha(LastChar))
-    {
-        Identifier_string = LastChar;
-        while (isalnum(LastChar = fgetc(file)))
-        {
-            Identifier_string += LastChar;
-        }
-
-        if (Identifier_string == "def")
-            return DEF_TOKEN;
-
-        return IDENTIFIER_TOKEN;
-    }
+        const char *Tok_Start = Cur_Ptr;
+        char ThisChar = *Cur_Ptr;
 
-    if (isdigit(LastChar))
-    {
-        std::string NumStr;
-        do
+        if (llvm::isAlpha(ThisChar))
         {
-            NumStr += LastChar;
-            LastChar = fgetc(file);
-        } while (isdigit(LastChar));
+            while (llvm::isAlnum(*++Cur_Ptr))
+                ;
+            Identifier_string = llvm::StringRef(Tok_Start, Cur_Ptr - Tok_Start);
 
-        Numeric_Val = std::strtod(NumStr.c_str(), nullptr);
+            // 只有一个关键字，一次比较即可
+            if (Identifier_string == "def")
+                return DEF_TOKEN;
 
-        return NUMERIC_TOKEN;
-    }
+            return IDENTIFIER_TOKEN;
+        }
 
-    if (LastChar == '#')
-    {
-        do
+        if (llvm::isDigit(ThisChar))
         {
-            LastChar = fgetc(file);
-        } while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
+            // 用 64 位无符号数累加，超过 INT_MAX 后不再累加，避免有符号溢出
+            uint64_t Val = 0;
+            do
+            {
+                if (Val <= INT_MAX)
+                    Val = Val * 10 + (*Cur_Ptr - '0');
+            } while (llvm::isDigit(*++Cur_Ptr));
+
+            Numeric_Out_Of_Range = Val > INT_MAX;
+            if (Numeric_Out_Of_Range)
+            {
+                llvm::errs() << "integer literal " << llvm::StringRef(Tok_Start, Cur_Ptr - Tok_Start)
+                             << " is out of range\n";
+                Val = INT_MAX;
+            }
+            Numeric_Val = (int)Val;
+            return NUMERIC_TOKEN;
+        }
 
-        if (LastChar != EOF)
-            return get_token();
-    }
+        if (ThisChar == '#')
+        {
+            while (*Cur_Ptr != '\n' && *Cur_Ptr != '\r' && Cur_Ptr != Buffer_End)
+                ++Cur_Ptr;
+            continue;
+        }
 
-    if (LastChar == EOF)
-        return EOF_TOKEN;
+        if (Cur_Ptr == Buffer_End)
+            return EOF_TOKEN;
 
-    int ThisChar = LastChar;
-    LastChar = fgetc(file);
-    return ThisChar;
+        ++Cur_Ptr;
+        return (unsigned char)ThisChar;
+    }
 }
 
 // 包含了代码中所有的函数和变量
@@ -288,6 +301,8 @@ static BaseAST *Base_Parser()
 
 static BaseAST *numeric_parser()
 {
+    if (Numeric_Out_Of_Range)
+        return 0; // error: integer literal out of range
     BaseAST *Result = new NumericAST(Numeric_Val);
     next_token();
     return Result;
@@ -303,7 +318,7 @@ static BaseAST *expression_parser()
 
 static BaseAST *identifier_parser()
 {
-    std::string IdName = Identifier_string;
+    std::string IdName = Identifier_string.str();
 
     next_token();
 
@@ -342,7 +357,7 @@ static FunctionDeclAST *func_decl_parser()
     if (Current_Token != IDENTIFIER_TOKEN)
         return 0;
 
-    std::string FnName = Identifier_string;
+    std::string FnName = Identifier_string.str();
 
     next_token();
 
@@ -351,7 +366,7 @@ static FunctionDeclAST *func_decl_parser()
 
     std::vector<std::string> Function_Argument_Names;
     while (next_token() == IDENTIFIER_TOKEN)
-        Function_Argument_Names.push_back(Identifier_string);
+        Function_Argument_Names.push_back(Identifier_string.str());
 
     if (Current_Token != ')')
         return 0; // error: expected ')'
@@ -508,11 +523,15 @@ int main(int argc, char *argv[])
 
     init_precedence();
 
-    file = fopen(argv[1], "r");
-    if (file == 0)
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> BufferOrErr = llvm::MemoryBuffer::getFileOrSTDIN(argc > 1 ? argv[1] : "-");
+    if (!BufferOrErr)
     {
         printf("File not found.\n");
+        return 1;
     }
+    Input_Buffer = std::move(*BufferOrErr);
+    Cur_Ptr = Input_Buffer->getBufferStart();
+    Buffer_End = Input_Buffer->getBufferEnd();
 
     next_token();
 
@@ -0,0 +1,64 @@
+// 缓冲区参数的基准测试：buf.toy 中的循环内核（sum、saxpy）与 C 逐元素调用 toy 函数（add1、axpy1）比较
+//   make bufbench && ./bufbench
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+int sum(int *a, int n);
+int saxpy(double a, double *x, double *y, int n);
+int add1(int s, int x);
+double axpy1(double a, double x, double y);
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(void)
+{
+    enum { N = 1 << 20, R = 200 };
+    int *a = malloc(N * sizeof(int));
+    double *x = malloc(N * sizeof(double));
+    double *y = malloc(N * sizeof(double));
+    for (int i = 0; i < N; i++)
+    {
+        a[i] = i & 7;
+        x[i] = i * 0.5;
+        y[i] = 1.0;
+    }
+
+    int s1 = 0, s2 = 0;
+    double t = now();
+    for (int r = 0; r < R; r++)
+        for (int i = 0; i < N; i++)
+            s1 = add1(s1, a[i]);
+    printf("sum   per-element %.3f s\n", now() - t);
+
+    t = now();
+    for (int r = 0; r < R; r++)
+        s2 += sum(a, N);
+    printf("sum   kernel      %.3f s\n", now() - t);
+
+    t = now();
+    for (int r = 0; r < R; r++)
+        for (int i = 0; i < N; i++)
+            y[i] = axpy1(0.5, x[i], y[i]);
+    printf("saxpy per-element %.3f s\n", now() - t);
+
+    double c1 = y[N - 1];
+    for (int i = 0; i < N; i++)
+        y[i] = 1.0;
+    t = now();
+    for (int r = 0; r < R; r++)
+        saxpy(0.5, x, y, N);
+    printf("saxpy kernel      %.3f s\n", now() - t);
+
+    // 两种方式的结果必须一致
+    printf("check %d %d %g %g\n", s1, s2, c1, y[N - 1]);
+    free(a);
+    free(x);
+    free(y);
+    return 0;
+}
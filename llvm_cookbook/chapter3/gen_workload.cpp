@@ -0,0 +1,172 @@
+// 生成可按规模放大的 toy 程序，作为 toy 前端的基准测试输入。
+// 同一组参数和种子总是生成同样的程序，基准结果可以复现。
+//
+//   ./gen_workload -defs=2000 -depth=6 -loops=3 -operators=8 -exprs=20 > big.toy
+#include <random>
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+static llvm::cl::opt<unsigned> Num_Defs("defs", llvm::cl::init(1000),
+                                        llvm::cl::desc("Number of ordinary defs f0, f1, ... to generate"));
+static llvm::cl::opt<unsigned> Depth("depth", llvm::cl::init(5),
+                                     llvm::cl::desc("Depth of the random expression tree in each def body"));
+static llvm::cl::opt<unsigned> Loop_Depth("loops", llvm::cl::init(2),
+                                          llvm::cl::desc("Nesting depth of the for loops in the loop kernels "
+                                                         "(0 = no loop kernels)"));
+static llvm::cl::opt<unsigned> Num_Operators("operators", llvm::cl::init(6),
+                                             llvm::cl::desc("Number of custom binary operators (at most 9); "
+                                                            "def bodies use them as often as the builtin ones"));
+static llvm::cl::opt<unsigned> Chain("chain", llvm::cl::init(0),
+                                     llvm::cl::desc("Also emit def chain(x), a flat chain of this many additions "
+                                                    "over its parameter, and one call to it"));
+static llvm::cl::opt<unsigned> Num_Exprs("exprs", llvm::cl::init(10),
+                                         llvm::cl::desc("Number of top-level expressions calling the generated defs"));
+static llvm::cl::opt<unsigned> Seed("seed", llvm::cl::init(1), llvm::cl::desc("Random seed"));
+
+// 自定义运算符可用的字符：不是内置运算符，也不会被词法分析器当成别的记号
+static const char Operator_Chars[] = "|&^%@$?>:";
+
+static std::mt19937 Rng;
+
+static unsigned random_below(unsigned N)
+{
+    return std::uniform_int_distribution<unsigned>(0, N - 1)(Rng);
+}
+
+// 前 Num_Leaf_Defs 个 def 不调用其他函数，后面的 def 只调用它们，执行时间不会随 def 数指数增长
+static const unsigned Num_Leaf_Defs = 32;
+
+// 深度为 Level 的随机表达式，叶子是参数 a b c 或小常量，内部节点是内置运算符、自定义运算符、
+// 一元运算符 !、if 或者对 f0 .. f(Callable-1) 之一的调用
+static void gen_expr(llvm::raw_ostream &OS, unsigned Level, unsigned Callable)
+{
+    if (Level == 0)
+    {
+        if (random_below(3) == 0)
+            OS << random_below(16);
+        else
+            OS << "abc"[random_below(3)];
+        return;
+    }
+
+    unsigned Kinds = Num_Operators ? 6 : 5;
+    switch (random_below(Kinds))
+    {
+    case 0:
+        if (Callable)
+        {
+            OS << 'f' << random_below(Callable) << '(';
+            gen_expr(OS, Level - 1, Callable);
+            OS << ", ";
+            gen_expr(OS, Level - 1, Callable);
+            OS << ", ";
+            gen_expr(OS, Level - 1, Callable);
+            OS << ')';
+            return;
+        }
+        [[fallthrough]];
+    case 1:
+        OS << "if ";
+        gen_expr(OS, Level - 1, Callable);
+        OS << " < " << random_below(64) << " then ";
+        gen_expr(OS, Level - 1, Callable);
+        OS << " else ";
+        gen_expr(OS, Level - 1, Callable);
+        return;
+    case 2:
+        OS << "!(";
+        gen_expr(OS, Level - 1, Callable);
+        OS << ')';
+        return;
+    default:
+    {
+        // 内置运算符和自定义运算符（有的话）机会均等
+        char Op;
+        if (Num_Operators && random_below(2))
+            Op = Operator_Chars[random_below(Num_Operators)];
+        else
+            Op = "+-*<"[random_below(4)];
+        OS << '(';
+        gen_expr(OS, Level - 1, Callable);
+        OS << ' ' << Op << ' ';
+        gen_expr(OS, Level - 1, Callable);
+        OS << ')';
+        return;
+    }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    llvm::cl::ParseCommandLineOptions(argc, argv, "toy workload generator\n");
+    if (Num_Operators > sizeof(Operator_Chars) - 1)
+    {
+        llvm::errs() << "at most " << sizeof(Operator_Chars) - 1 << " custom operators\n";
+        return 1;
+    }
+    Rng.seed(Seed);
+    llvm::raw_ostream &OS = llvm::outs();
+
+    // 运算符：优先级分散在 5..45，函数体各不相同
+    OS << "def unary!(v) if v then 0 else 1;\n";
+    for (unsigned i = 0; i != Num_Operators; ++i)
+    {
+        OS << "def binary" << Operator_Chars[i] << ' ' << 5 + i * 5 << " (x y) ";
+        switch (i % 3)
+        {
+        case 0:
+            OS << "if x < y then y - x else x - y;\n";
+            break;
+        case 1:
+            OS << "x * 3 + y;\n";
+            break;
+        default:
+            OS << "(x + y) / 2;\n";
+            break;
+        }
+    }
+
+    for (unsigned i = 0; i != Num_Defs; ++i)
+    {
+        OS << "def f" << i << "(a b c) ";
+        gen_expr(OS, Depth, i < Num_Leaf_Defs ? 0 : Num_Leaf_Defs);
+        OS << ";\n";
+    }
+
+    // 循环核：Loop_Depth 层嵌套 for，最内层累加到 var 中
+    if (Loop_Depth)
+    {
+        for (unsigned k = 0; k != 4; ++k)
+        {
+            OS << "def loop" << k << "(n) var s = 0 in (";
+            for (unsigned d = 0; d != Loop_Depth; ++d)
+                OS << "for i" << d << " = 0, i" << d << " < n in ";
+            OS << "s = s + ";
+            for (unsigned d = 0; d != Loop_Depth; ++d)
+                OS << (d ? " * " : "") << "(i" << d << " + " << k + 1 << ")";
+            OS << ") + s;\n";
+        }
+    }
+
+    for (unsigned i = 0; i != Num_Exprs && Num_Defs; ++i)
+        OS << 'f' << random_below(Num_Defs) << '(' << random_below(100) << ", " << random_below(100) << ", "
+           << random_below(100) << ");\n";
+    if (Loop_Depth)
+        OS << "loop0(20) + loop3(10);\n";
+
+    // 加法链建立在参数上，AST 化简不能把它折叠成常量
+    if (Chain)
+    {
+        OS << "def chain(x) x";
+        for (unsigned i = 1; i != Chain; ++i)
+        {
+            if (i % 2)
+                OS << " + x";
+            else
+                OS << " + " << i % 9 + 1;
+        }
+        OS << ";\nchain(" << random_below(100) << ");\n";
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+#!/bin/sh
+# 运行 toy 并与期望的输出比较（标准输出和标准错误一起）。
+# 每个 .toy 的第一行是 "# flags: ..."，给出运行时的参数；期望输出在同名的 .out 文件中。
+#
+#   tests/check_output.sh ./toy tests/nan.toy tests/repl_redefine.toy
+TOY=$1
+shift
+TMP=${TMPDIR:-/tmp}/toy-output.$$
+trap 'rm -f $TMP' EXIT
+
+Status=0
+for f in "$@"; do
+    Flags=`sed -n '1s/^# flags://p' $f`
+    $TOY $Flags $f > $TMP 2>&1
+    if cmp -s ${f%.toy}.out $TMP; then
+        echo "PASS $f"
+    else
+        echo "FAIL $f"
+        diff ${f%.toy}.out $TMP
+        Status=1
+    fi
+done
+exit $Status
@@ -0,0 +1,35 @@
+#!/bin/sh
+# 比较串行、-j=1 和 -j=4 生成的模块，它们必须一致（诊断信息也一起比较）。
+# -O0 逐字节比较；-O2/-O3 时内联产生的局部值名字与所在模块的内容有关，先用 opt -strip 去掉名字再比较。
+#
+#   tests/check_parallel.sh ./toy opt tests/parallel.toy test.txt
+TOY=$1
+OPT=$2
+shift 2
+TMP=${TMPDIR:-/tmp}/toy-check.$$
+mkdir -p $TMP
+trap 'rm -rf $TMP' EXIT
+
+Status=0
+for f in "$@"; do
+    for O in 0 2 3; do
+        $TOY -O=$O $f > $TMP/serial.ll 2>&1
+        for j in 1 4; do
+            $TOY -O=$O -j=$j $f > $TMP/parallel.ll 2>&1
+            if [ $O = 0 ]; then
+                cmp -s $TMP/serial.ll $TMP/parallel.ll
+            else
+                $OPT -strip -S < $TMP/serial.ll -o $TMP/serial.strip.ll &&
+                    $OPT -strip -S < $TMP/parallel.ll -o $TMP/parallel.strip.ll &&
+                    cmp -s $TMP/serial.strip.ll $TMP/parallel.strip.ll
+            fi
+            if [ $? = 0 ]; then
+                echo "PASS $f -O$O -j=$j"
+            else
+                echo "FAIL $f -O$O -j=$j"
+                Status=1
+            fi
+        done
+    done
+done
+exit $Status
@@ -1,13 +1,61 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <set>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <algorithm>
+#include <mutex>
+#include <time.h>
+
+#include <sys/resource.h>
 
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Value.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Verifier.h"
-#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Transforms/InstCombine/InstCombine.h"
+#include "llvm/Transforms/IPO/GlobalDCE.h"
+#include "llvm/Transforms/IPO/Inliner.h"
+#include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Scalar/LICM.h"
+#include "llvm/Transforms/Scalar/LoopUnrollPass.h"
+#include "llvm/Transforms/Scalar/Reassociate.h"
+#include "llvm/Transforms/Scalar/SimplifyCFG.h"
+#include "llvm/Transforms/Scalar/TailRecursionElimination.h"
+#include "llvm/Transforms/Utils/Mem2Reg.h"
+#include "llvm/Transforms/Vectorize/LoopVectorize.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
 
 enum Token_Type
 {
@@ -22,21 +70,187 @@ enum Token_Type
     FOR_TOKEN,
     IN_TOKEN,
     UNARY_TOKEN,
-    BINARY_TOKEN
+    BINARY_TOKEN,
+    VAR_TOKEN,
+    TYPE_TOKEN,
+    FP_NUMERIC_TOKEN
+};
+
+// 值的类型：int 是 32 位整数（默认），double，vec4 是 4 个 double 组成的向量；
+// int[]、double[] 是调用者传入的缓冲区（元素指针），只能作参数、下标读写和传给其他函数
+enum ValueType : unsigned char
+{
+    TYPE_NONE,
+    TYPE_INT,
+    TYPE_DOUBLE,
+    TYPE_VEC4,
+    TYPE_INT_BUFFER,
+    TYPE_DOUBLE_BUFFER
 };
 
+static bool is_buffer_type(ValueType Ty)
+{
+    return Ty == TYPE_INT_BUFFER || Ty == TYPE_DOUBLE_BUFFER;
+}
+
+// 能参与内置运算的类型
+static bool is_arith_type(ValueType Ty)
+{
+    return Ty == TYPE_INT || Ty == TYPE_DOUBLE || Ty == TYPE_VEC4;
+}
+
+// 能否隐式转换：标量之间互转，标量可以复制到 vec4，其余只能是同一类型
+static bool can_convert(ValueType From, ValueType To)
+{
+    if (From == To)
+        return true;
+    return (From == TYPE_INT || From == TYPE_DOUBLE) && is_arith_type(To);
+}
+
 // store the value of numeric tokens
 static int Numeric_Val;
+// 整数常量超出 int 的范围，词法分析器已经报告，numeric_parser 据此拒绝
+static bool Numeric_Out_Of_Range;
+// -j 回退到串行模式重新解析时，第一遍已经报告过的词法错误不再重复
+static bool Quiet_Lexer;
+// 带小数点的数字记号
+static double FP_Numeric_Val;
+// TYPE_TOKEN 表示的类型
+static ValueType Type_Val;
+
+// 标识符直接指向输入缓冲区，不再逐字符拷贝
+static llvm::StringRef Identifier_string;
+
+// 运算符优先级，按字符直接索引，-1 表示不是二元运算符
+static int Operator_Precedence[256];
+
+// 整个输入文件通过 MemoryBuffer 读入（大文件使用 mmap），词法分析直接在缓冲区上进行。
+// MemoryBuffer 保证缓冲区以 '\0' 结尾，内层循环因此不需要检查边界。
+static std::unique_ptr<llvm::MemoryBuffer> Input_Buffer;
+// 读入的源码总字节数（-repl 模式下是各段之和）
+static size_t Input_Bytes;
+static const char *Cur_Ptr;
+static const char *Buffer_End;
+// 最近一次 get_token() 返回的记号在缓冲区中的起始位置
+static const char *Token_Start;
+// 上一个记号的结束位置（最近一次 get_token() 之前跳过的空白和注释从这里开始）
+static const char *Prev_Token_End;
+
+struct Keyword
+{
+    const char *Name;
+    int Token;
+    ValueType Type; // 类型关键字对应的类型
+};
 
-static std::string Identifier_string;
-
-static std::map<char, int> Operator_Precedence;
+// 关键字的完美哈希表：槽位 = (长度 * 2 + 首字符 * 3 + 末字符) & 31，12 个关键字互不冲突，
+// 命中槽位后只需一次字符串比较
+static const Keyword Keyword_Table[32] = {
+    {nullptr, 0, TYPE_NONE},          {nullptr, 0, TYPE_NONE},
+    {"unary", UNARY_TOKEN, TYPE_NONE}, {nullptr, 0, TYPE_NONE},
+    {nullptr, 0, TYPE_NONE},          {"if", IF_TOKEN, TYPE_NONE},
+    {nullptr, 0, TYPE_NONE},          {nullptr, 0, TYPE_NONE},
+    {nullptr, 0, TYPE_NONE},          {nullptr, 0, TYPE_NONE},
+    {"for", FOR_TOKEN, TYPE_NONE},    {"binary", BINARY_TOKEN, TYPE_NONE},
+    {nullptr, 0, TYPE_NONE},          {"in", IN_TOKEN, TYPE_NONE},
+    {nullptr, 0, TYPE_NONE},          {nullptr, 0, TYPE_NONE},
+    {nullptr, 0, TYPE_NONE},          {nullptr, 0, TYPE_NONE},
+    {"then", THEN_TOKEN, TYPE_NONE},  {nullptr, 0, TYPE_NONE},
+    {nullptr, 0, TYPE_NONE},          {"int", TYPE_TOKEN, TYPE_INT},
+    {nullptr, 0, TYPE_NONE},          {nullptr, 0, TYPE_NONE},
+    {"def", DEF_TOKEN, TYPE_NONE},    {nullptr, 0, TYPE_NONE},
+    {"var", VAR_TOKEN, TYPE_NONE},    {nullptr, 0, TYPE_NONE},
+    {"else", ELSE_TOKEN, TYPE_NONE},  {"double", TYPE_TOKEN, TYPE_DOUBLE},
+    {"vec4", TYPE_TOKEN, TYPE_VEC4},  {nullptr, 0, TYPE_NONE}};
+
+static int lookup_keyword(llvm::StringRef Id)
+{
+    if (Id.size() < 2 || Id.size() > 6)
+        return IDENTIFIER_TOKEN;
 
-// static llvm::ExecutionEngine *TheExecutionEngine;
+    const Keyword &K = Keyword_Table[(Id.size() * 2 + (unsigned char)Id.front() * 3 + (unsigned char)Id.back()) & 31];
+    if (K.Name && Id == K.Name)
+    {
+        Type_Val = K.Type;
+        return K.Token;
+    }
 
-FILE *file;
+    return IDENTIFIER_TOKEN;
+}
 
 static int get_token()
+{
+    Prev_Token_End = Cur_Ptr;
+    while (1)
+    {
+        while (llvm::isSpace(*Cur_Ptr))
+            ++Cur_Ptr;
+
+        const char *Tok_Start = Token_Start = Cur_Ptr;
+        char ThisChar = *Cur_Ptr;
+
+        if (llvm::isAlpha(ThisChar))
+        {
+            while (llvm::isAlnum(*++Cur_Ptr))
+                ;
+            Identifier_string = llvm::StringRef(Tok_Start, Cur_Ptr - Tok_Start);
+            return lookup_keyword(Identifier_string);
+        }
+
+        if (llvm::isDigit(ThisChar))
+        {
+            // 用 64 位无符号数累加，超过 INT_MAX 后不再累加，避免有符号溢出
+            uint64_t Val = 0;
+            do
+            {
+                if (Val <= INT_MAX)
+                    Val = Val * 10 + (*Cur_Ptr - '0');
+            } while (llvm::isDigit(*++Cur_Ptr));
+
+            // 1.5 这样带小数部分的是 double 常量，整数部分之后交给 strtod
+            if (*Cur_Ptr == '.' && llvm::isDigit(Cur_Ptr[1]))
+            {
+                char *End;
+                FP_Numeric_Val = strtod(Tok_Start, &End);
+                Cur_Ptr = End;
+                return FP_NUMERIC_TOKEN;
+            }
+
+            Numeric_Out_Of_Range = Val > INT_MAX;
+            if (Numeric_Out_Of_Range)
+            {
+                if (!Quiet_Lexer)
+                    llvm::errs() << "integer literal " << llvm::StringRef(Tok_Start, Cur_Ptr - Tok_Start)
+                                 << " is out of range\n";
+                Val = INT_MAX;
+            }
+            Numeric_Val = (int)Val;
+            return NUMERIC_TOKEN;
+        }
+
+        if (ThisChar == '#')
+        {
+            while (*Cur_Ptr != '\n' && *Cur_Ptr != '\r' && Cur_Ptr != Buffer_End)
+                ++Cur_Ptr;
+            continue;
+        }
+
+        if (Cur_Ptr == Buffer_End)
+            return EOF_TOKEN;
+
+        ++Cur_Ptr;
+        return (unsigned char)ThisChar;
+    }
+}
+
+static void reset_lexer()
+{
+    Cur_Ptr = Input_Buffer->getBufferStart();
+    Buffer_End = Input_Buffer->getBufferEnd();
+}
+
+// 逐字符 fgetc 的旧词法分析器，仅供 -bench-lex 对比吞吐量
+static int legacy_get_token(FILE *file, std::string &Identifier_string)
 {
     static int LastChar = ' '; // Placeholder value for first character
 
@@ -69,6 +283,10 @@ static int get_token()
             return BINARY_TOKEN;
         if (Identifier_string == "unary")
             return UNARY_TOKEN;
+        if (Identifier_string == "var")
+            return VAR_TOKEN;
+        if (Identifier_string == "int" || Identifier_string == "double" || Identifier_string == "vec4")
+            return TYPE_TOKEN;
 
         return IDENTIFIER_TOKEN;
     }
@@ -82,6 +300,26 @@ static int get_token()
             LastChar = fgetc(file);
         } while (isdigit(LastChar));
 
+        // 与 get_token 一致，小数点后紧跟数字才是 double 常量，否则把多读的字符退回去
+        if (LastChar == '.')
+        {
+            int Next = fgetc(file);
+            if (isdigit(Next))
+            {
+                NumStr += '.';
+                LastChar = Next;
+                do
+                {
+                    NumStr += LastChar;
+                    LastChar = fgetc(file);
+                } while (isdigit(LastChar));
+
+                FP_Numeric_Val = std::strtod(NumStr.c_str(), nullptr);
+                return FP_NUMERIC_TOKEN;
+            }
+            ungetc(Next, file);
+        }
+
         Numeric_Val = std::strtod(NumStr.c_str(), nullptr);
 
         return NUMERIC_TOKEN;
@@ -95,7 +333,7 @@ static int get_token()
         } while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
 
         if (LastChar != EOF)
-            return get_token();
+            return legacy_get_token(file, Identifier_string);
     }
 
     if (LastChar == EOF)
@@ -106,358 +344,1784 @@ static int get_token()
     return ThisChar;
 }
 
+// JIT 模式下每个模块都要交给 ORC，因此主线程的上下文由 ThreadSafeContext 持有
+static llvm::orc::ThreadSafeContext TheThreadSafeContext(std::make_unique<llvm::LLVMContext>());
+static llvm::IRBuilder<> Main_Builder(*TheThreadSafeContext.getContext());
+
+// 代码生成的状态按线程保存：主线程指向上面的上下文和 Main_Builder（在 main() 中设置），
+// -j 并行编译时每个工作线程为自己负责的一批 def 建立独立的上下文、Builder 和模块。
 // 包含了代码中所有的函数和变量
-static llvm::Module *Module_ob;
-static llvm::LLVMContext TheGlobalContext;
+static thread_local llvm::Module *Module_ob;
+static thread_local llvm::LLVMContext *TheContext;
 // 帮助生成 LLVM IR 并且记录程序的当前点，以插入 LLVM 指令;另外，Builder 对象有创建新指令的函数。
-static llvm::IRBuilder<> Builder(TheGlobalContext);
-// 符号表
-static std::map<std::string, llvm::Value *> Named_Values;
-static llvm::FunctionPassManager *Global_FP;
-
-class BaseAST
+static thread_local llvm::IRBuilder<> *Builder;
+// 标识符在解析时驻留为整数编号。只有解析阶段（主线程）会写入，代码生成阶段只读。
+class IdentifierTable
 {
-public:
-    virtual ~BaseAST() {}
-    virtual llvm::Value *codegen() = 0;
-};
-
-class VariableAST : public BaseAST
-{
-    std::string Var_Name;
+    llvm::StringMap<unsigned> Ids;
+    std::vector<llvm::StringRef> Names;
 
 public:
-    VariableAST(const std::string &name) : Var_Name(name) {}
-    virtual llvm::Value *codegen();
+    unsigned intern(llvm::StringRef Name)
+    {
+        std::pair<llvm::StringMap<unsigned>::iterator, bool> It = Ids.insert(std::make_pair(Name, Names.size()));
+        if (It.second)
+            Names.push_back(It.first->getKey());
+        return It.first->second;
+    }
+
+    llvm::StringRef getName(unsigned Id) const { return Names[Id]; }
 };
 
-llvm::Value *VariableAST::codegen()
-{
-    llvm::Value *V = Named_Values[Var_Name];
-    return V ? V : 0;
-}
+static IdentifierTable Identifiers;
 
-class NumericAST : public BaseAST
+// 符号表：按标识符编号直接索引，未绑定时为 T()。
+// 作用域用撤销栈实现：bind 时把旧值压栈，leaveScope 时弹栈恢复到进入作用域时的状态。
+template <typename T>
+class SymbolTable
 {
-    int numeric_val;
+    std::vector<T> Values;
+    std::vector<std::pair<unsigned, T>> Undo;
 
 public:
-    NumericAST(int val) : numeric_val(val) {}
-    virtual llvm::Value *codegen();
-};
+    T lookup(unsigned Id) const { return Id < Values.size() ? Values[Id] : T(); }
 
-llvm::Value *NumericAST::codegen()
-{
-    return llvm::ConstantInt::get(llvm::Type::getInt32Ty(TheGlobalContext), numeric_val);
-}
+    void bind(unsigned Id, T V)
+    {
+        if (Id >= Values.size())
+            Values.resize(Id + 1);
+        Undo.push_back(std::make_pair(Id, Values[Id]));
+        Values[Id] = V;
+    }
 
-class BinaryAST : public BaseAST
-{
-    std::string Bin_Operator;
-    BaseAST *LHS, *RHS;
+    size_t enterScope() const { return Undo.size(); }
 
-public:
-    BinaryAST(const std::string &op, BaseAST *lhs, BaseAST *rhs) : Bin_Operator(op), LHS(lhs), RHS(rhs) {}
-    virtual llvm::Value *codegen();
+    void leaveScope(size_t Mark)
+    {
+        while (Undo.size() > Mark)
+        {
+            Values[Undo.back().first] = Undo.back().second;
+            Undo.pop_back();
+        }
+    }
+
+    // 构造时进入作用域，析构时退出：出错提前返回时绑定也不会留到下一个顶层项
+    class Scope
+    {
+        SymbolTable &Table;
+        size_t Mark;
+
+    public:
+        explicit Scope(SymbolTable &table) : Table(table), Mark(table.enterScope()) {}
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+        ~Scope() { Table.leaveScope(Mark); }
+    };
 };
 
-llvm::Value *BinaryAST::codegen()
-{
-    llvm::Value *L = LHS->codegen();
-    llvm::Value *R = RHS->codegen();
+// 代码生成时变量的栈槽
+static thread_local SymbolTable<llvm::Value *> Named_Values;
+// 解析时变量的类型，只在主线程使用
+static SymbolTable<ValueType> Var_Types;
 
-    switch (atoi(Bin_Operator.c_str()))
+static llvm::Type *get_llvm_type(ValueType Ty)
+{
+    switch (Ty)
     {
-    case '<':
-        L = Builder.CreateICmpULT(L, R, "cmptmp");
-        return Builder.CreateZExt(L, llvm::Type::getInt32Ty(TheGlobalContext), "booltmp");
-    case '+':
-        return Builder.CreateAdd(L, R, "addtmp");
-    case '-':
-        return Builder.CreateSub(L, R, "subtmp");
-    case '*':
-        return Builder.CreateMul(L, R, "multmp");
-    case '/':
-        return Builder.CreateUDiv(L, R, "divtmp");
-
+    case TYPE_DOUBLE:
+        return llvm::Type::getDoubleTy(*TheContext);
+    case TYPE_VEC4:
+        return llvm::FixedVectorType::get(llvm::Type::getDoubleTy(*TheContext), 4);
+    case TYPE_INT_BUFFER:
+        return llvm::Type::getInt32PtrTy(*TheContext);
+    case TYPE_DOUBLE_BUFFER:
+        return llvm::Type::getDoublePtrTy(*TheContext);
     default:
-        break;
+        return llvm::Type::getInt32Ty(*TheContext);
     }
-    llvm::Function *F = Module_ob->getFunction(std::string("binary") + Bin_Operator.c_str());
-    llvm::Value *Ops[2] = {L, R};
-    return Builder.CreateCall(F, Ops, "binop");
 }
 
-class FunctionDeclAST
+static ValueType get_value_type(llvm::Type *Ty)
 {
-    std::string Func_Name;
-    std::vector<std::string> Arguments;
-    bool isOperator;
-    unsigned Precedence;
+    if (Ty->isDoubleTy())
+        return TYPE_DOUBLE;
+    if (Ty->isVectorTy())
+        return TYPE_VEC4;
+    if (Ty->isPointerTy())
+        return Ty->getPointerElementType()->isDoubleTy() ? TYPE_DOUBLE_BUFFER : TYPE_INT_BUFFER;
+    return TYPE_INT;
+}
+static thread_local llvm::FunctionPassManager *Global_FP;
+static thread_local llvm::LoopAnalysisManager *Global_LAM;
+static thread_local llvm::FunctionAnalysisManager *Global_FAM;
+static thread_local llvm::CGSCCAnalysisManager *Global_CGAM;
+static thread_local llvm::ModuleAnalysisManager *Global_MAM;
+// TargetMachine 内部缓存子目标信息，不能跨线程共享，-j 的每个批次各建一份
+static thread_local llvm::TargetMachine *Target_Machine;
+
+static llvm::cl::opt<std::string> InputFilename(llvm::cl::Positional, llvm::cl::desc("<input file>"), llvm::cl::Required);
+static llvm::cl::opt<bool> BenchLex("bench-lex",
+                                    llvm::cl::desc("Measure lexing throughput against the fgetc lexer and exit"));
+static llvm::cl::opt<bool> UseJIT("jit", llvm::cl::desc("Compile and run each top-level expression through the ORC JIT"));
+static llvm::cl::opt<bool> Repl("repl",
+                                llvm::cl::desc("Read the input ('-' for stdin) as a stream and run each ';'-terminated "
+                                               "item through the JIT as soon as it arrives (implies -jit)"));
+static llvm::cl::opt<bool> ReportLatency("report-latency",
+                                         llvm::cl::desc("In -repl mode, print the latency of each top-level expression "
+                                                        "and a summary at exit"));
+
+static llvm::cl::opt<char> OptLevel("O",
+                                    llvm::cl::desc("Optimization level. [-O0, -O1, -O2, or -O3] (default = '-O0')"),
+                                    llvm::cl::Prefix, llvm::cl::ZeroOrMore, llvm::cl::init('0'));
+static llvm::cl::opt<bool> UseFlatAST("flat-ast",
+                                      llvm::cl::desc("Generate code from a flat, index-based node pool instead of the "
+                                                     "pointer-linked AST"));
+static llvm::cl::opt<unsigned> Threads("j", llvm::cl::value_desc("threads"), llvm::cl::init(0),
+                                       llvm::cl::desc("Parse the whole file, then generate and optimize defs on this many "
+                                                      "threads (0 = one item at a time)"));
+static llvm::cl::opt<std::string> CacheDir("cache-dir", llvm::cl::value_desc("directory"),
+                                          llvm::cl::desc("Reuse optimized bitcode of unchanged defs from this directory"));
+static llvm::cl::opt<bool> ReportMemory("report-memory",
+                                        llvm::cl::desc("Print peak RSS and AST arena usage after compilation"));
+static llvm::cl::opt<bool> ReportCompileTime("report-compile-time",
+                                             llvm::cl::desc("Print codegen and optimization time for the selected -O level"));
+static llvm::cl::opt<bool> SimplifyAST("simplify-ast", llvm::cl::init(true),
+                                       llvm::cl::desc("Fold constants, reduce strength and drop dead branches in the AST "
+                                                      "before codegen (default = on)"));
+static llvm::cl::opt<bool> ReportSimplify("report-simplify",
+                                          llvm::cl::desc("Print how many AST nodes -simplify-ast removed"));
+static llvm::cl::opt<bool> ModuleInline("module-inline", llvm::cl::init(true),
+                                        llvm::cl::desc("At -O3, inline small defs and operators across the whole "
+                                                       "module before output (default = on)"));
+static llvm::cl::opt<bool> ReportCalls("report-calls",
+                                       llvm::cl::desc("Print the number of call sites before and after module inlining"));
+
+enum Stats_Format
+{
+    STATS_TEXT,
+    STATS_JSON
+};
+static llvm::cl::opt<bool> PhaseStats("phase-stats",
+                                      llvm::cl::desc("Extend -report-compile-time with per-phase CPU time, item counts "
+                                                     "and allocated bytes"));
+static llvm::cl::opt<Stats_Format> PhaseStatsFormat("phase-stats-format", llvm::cl::init(STATS_TEXT),
+                                                    llvm::cl::desc("Format of -phase-stats output"),
+                                                    llvm::cl::values(clEnumValN(STATS_TEXT, "text", "Table (default)"),
+                                                                     clEnumValN(STATS_JSON, "json", "JSON object")));
+static llvm::cl::opt<std::string> PhaseStatsFile("phase-stats-file", llvm::cl::value_desc("filename"),
+                                                 llvm::cl::desc("Write -phase-stats output to this file instead of "
+                                                                "stderr"));
+
+enum Emit_Type
+{
+    EMIT_LL,
+    EMIT_BC,
+    EMIT_ASM,
+    EMIT_OBJ
+};
+static llvm::cl::opt<Emit_Type> Emit("emit", llvm::cl::desc("Kind of output to produce"), llvm::cl::init(EMIT_LL),
+                                     llvm::cl::values(clEnumValN(EMIT_LL, "ll", "Textual LLVM IR (default)"),
+                                                      clEnumValN(EMIT_BC, "bc", "LLVM bitcode"),
+                                                      clEnumValN(EMIT_ASM, "asm", "Native assembly"),
+                                                      clEnumValN(EMIT_OBJ, "obj", "Native object file")));
+static llvm::cl::opt<bool> CompileOnly("c", llvm::cl::desc("Emit a native object file (same as --emit=obj)"));
+static llvm::cl::opt<std::string> OutputFilename("o", llvm::cl::value_desc("filename"),
+                                                 llvm::cl::desc("Output file (default: stdout for ll, otherwise the "
+                                                                "input name with .bc/.s/.o)"));
+static llvm::cl::opt<std::string> MCPU("mcpu", llvm::cl::value_desc("cpu-name"), llvm::cl::init("generic"),
+                                       llvm::cl::desc("Target CPU, or 'native' for the host"));
+static llvm::cl::opt<std::string> MAttrs("mattr", llvm::cl::value_desc("a1,+a2,-a3,..."),
+                                         llvm::cl::desc("Target features, added after those implied by -mcpu"));
+
+// -j 模式下并行生成阶段的墙钟时间（各阶段的耗时由下面的 PhaseTimer 统计）
+static std::chrono::steady_clock::duration Parallel_Time;
+// -repl 模式：当前一段输入读完的时刻，以及每个顶层表达式从输入到达到打印出结果的延迟
+static std::chrono::steady_clock::time_point Chunk_Ready;
+static std::vector<double> Repl_Latencies;
+static thread_local unsigned Num_Optimized_Functions;
+
+// 各编译阶段的墙钟时间，-report-compile-time 据此输出汇总；-phase-stats 另外统计本线程 CPU 时间、
+// 经过 operator new 分配的字节数（需要定义 TOY_COUNT_ALLOCATIONS 构建），以及该阶段处理的条目数
+// （词法是记号数，解析是 AST 节点数，代码生成和优化是生成/优化后的指令数，输出是字节数）。
+// 按线程累计，-j 的工作线程在每批完成后并入主线程。
+enum Compile_Phase
+{
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_CODEGEN,
+    PHASE_VERIFY,
+    PHASE_OPTIMIZE,
+    PHASE_LINK,
+    PHASE_MODULE_OPTIMIZE,
+    PHASE_JIT,
+    PHASE_EXECUTE,
+    PHASE_OUTPUT,
+    NUM_PHASES
+};
 
-public:
-    FunctionDeclAST(const std::string &name,
-                    const std::vector<std::string> &args,
-                    bool isoperator = false,
-                    unsigned prec = 0) : Func_Name(name), Arguments(args), isOperator(isoperator), Precedence(prec) {}
+static const char *const Phase_Names[NUM_PHASES] = {"lex",  "parse",           "codegen", "verify",  "optimize",
+                                                    "link", "module-optimize", "jit",     "execute", "output"};
+static const char *const Phase_Units[NUM_PHASES] = {"tokens",      "nodes",       "instructions", "functions",
+                                                    "instructions", "batches",    "instructions", "expressions",
+                                                    "expressions",  "bytes"};
 
-    bool isUnaryOp() const { return isOperator && Arguments.size() == 1; }
-    bool isBinaryOp() const { return isOperator && Arguments.size() == 2; }
+struct Phase_Stats
+{
+    uint64_t Wall_Ns = 0, CPU_Ns = 0, Alloc_Bytes = 0, Runs = 0, Count = 0;
+};
 
-    char getOperatorName() const
-    {
-        assert(isUnaryOp() || isBinaryOp());
-        return Func_Name[Func_Name.size() - 1];
-    }
+static thread_local Phase_Stats Phases[NUM_PHASES];
+// 本线程经 operator new 分配的累计字节数
+static thread_local uint64_t Allocated_Bytes;
 
-    unsigned getBinaryPrecedence() const
-    {
-        return Precedence;
-    }
+#ifdef TOY_COUNT_ALLOCATIONS
+static const bool Count_Allocations = true;
 
-    virtual llvm::Function *codegen();
-};
+void *operator new(size_t Size)
+{
+    Allocated_Bytes += Size;
+    if (void *P = malloc(Size ? Size : 1))
+        return P;
+    llvm::report_bad_alloc_error("operator new failed");
+}
 
-llvm::Function *FunctionDeclAST::codegen()
+void operator delete(void *P) noexcept { free(P); }
+void operator delete(void *P, size_t) noexcept { free(P); }
+#else
+static const bool Count_Allocations = false;
+#endif
+
+static uint64_t thread_cpu_ns()
 {
-    std::vector<llvm::Type *> Integers(Arguments.size(), llvm::Type::getInt32Ty(TheGlobalContext));
-    llvm::FunctionType *FT = llvm::FunctionType::get(llvm::Type::getInt32Ty(TheGlobalContext), Integers, false);
-    llvm::Function *F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, Func_Name, Module_ob);
+    struct timespec TS;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &TS);
+    return (uint64_t)TS.tv_sec * 1000000000 + TS.tv_nsec;
+}
 
-    if (F->getName() != Func_Name)
+// 作用域计时：墙钟时间总是记录，线程 CPU 时间和分配字节数只在 -phase-stats 时读取
+class PhaseTimer
+{
+    Compile_Phase Phase;
+    std::chrono::steady_clock::time_point Wall;
+    uint64_t CPU = 0, Alloc = 0;
+
+public:
+    explicit PhaseTimer(Compile_Phase P) : Phase(P), Wall(std::chrono::steady_clock::now())
     {
-        F->eraseFromParent();
-        F = Module_ob->getFunction(Func_Name);
-        if (!F->empty())
-            return 0;
-        if (F->arg_size() != Arguments.size())
-            return 0;
+        if (!PhaseStats)
+            return;
+        CPU = thread_cpu_ns();
+        Alloc = Allocated_Bytes;
     }
 
-    unsigned Idx = 0;
-    for (llvm::Function::arg_iterator Arg_It = F->arg_begin(); Idx != Arguments.size(); ++Arg_It, ++Idx)
+    ~PhaseTimer()
     {
-        Arg_It->setName(Arguments[Idx]);
-        Named_Values[Arguments[Idx]] = Arg_It;
+        Phase_Stats &S = Phases[Phase];
+        S.Wall_Ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Wall).count();
+        ++S.Runs;
+        if (!PhaseStats)
+            return;
+        S.CPU_Ns += thread_cpu_ns() - CPU;
+        S.Alloc_Bytes += Allocated_Bytes - Alloc;
     }
+};
 
-    return F;
+static double phase_ms(Compile_Phase P)
+{
+    return Phases[P].Wall_Ns / 1e6;
 }
 
-class FunctionDefnAST
+static void count_phase(Compile_Phase P, uint64_t N)
 {
-    FunctionDeclAST *Func_Decl;
-    BaseAST *Body;
-
-public:
-    FunctionDefnAST(FunctionDeclAST *decl, BaseAST *body) : Func_Decl(decl), Body(body) {}
-    virtual llvm::Function *codegen();
-};
+    Phases[P].Count += N;
+}
 
-llvm::Function *FunctionDefnAST::codegen()
-{
-    Named_Values.clear();
+static std::unique_ptr<llvm::orc::LLJIT> TheJIT;
+static llvm::ExitOnError ExitOnErr;
 
-    llvm::Function *TheFunction = Func_Decl->codegen();
-    if (TheFunction == 0)
-        return 0;
+// 顶层表达式在 JIT 模式下编译成这个名字的匿名函数，执行完即删除
+static const char *Anon_Expr_Name = "__anon_expr";
 
-    if (Func_Decl->isBinaryOp())
-        Operator_Precedence[Func_Decl->getOperatorName()] = Func_Decl->getBinaryPrecedence();
+static llvm::Function *getFunction(const std::string &Name);
 
-    llvm::BasicBlock *BB = llvm::BasicBlock::Create(TheGlobalContext, "entry", TheFunction);
-    Builder.SetInsertPoint(BB);
+// 当前模块中用户自定义运算符对应的函数，按运算符字符直接索引，只在第一次使用时按名字查找。
+// 换模块或函数被删除时清空。
+static thread_local llvm::Function *Binary_Operator_Fns[256];
+static thread_local llvm::Function *Unary_Operator_Fns[256];
 
-    if (llvm::Value *RetVal = Body->codegen())
-    {
-        Builder.CreateRet(RetVal);
-        verifyFunction(*TheFunction);
-        return TheFunction;
-    }
+static llvm::Function *getOperatorFunction(llvm::Function **Table, const char *Prefix, char Op)
+{
+    llvm::Function *&F = Table[(unsigned char)Op];
+    if (F == nullptr)
+        F = getFunction(std::string(Prefix) + Op);
+    return F;
+}
 
-    TheFunction->eraseFromParent();
-    return 0;
+static void reset_operator_tables()
+{
+    std::fill(std::begin(Binary_Operator_Fns), std::end(Binary_Operator_Fns), nullptr);
+    std::fill(std::begin(Unary_Operator_Fns), std::end(Unary_Operator_Fns), nullptr);
 }
 
-class FunctionCallAST : public BaseAST
+class FlatAST;
+
+class BaseAST
 {
-    std::string Function_Callee;
-    std::vector<BaseAST *> Function_Arguments;
+protected:
+    // 表达式的类型，在解析时确定
+    ValueType Ty;
 
 public:
-    FunctionCallAST(const std::string &callee, std::vector<BaseAST *> &args) : Function_Callee(callee), Function_Arguments(args) {}
-    virtual llvm::Value *codegen();
+    BaseAST(ValueType ty) : Ty(ty) {}
+    virtual ~BaseAST() {}
+    ValueType getType() const { return Ty; }
+    virtual llvm::Value *codegen() = 0;
+    // 按后序把子树写入扁平节点池，返回根节点的下标
+    virtual unsigned flatten(FlatAST &Pool) const = 0;
+    // 先化简子节点，再返回化简后的自身或替代它的节点（新节点同样在 AST_Arena 中分配）
+    virtual BaseAST *simplify() { return this; }
+    // 没有副作用且一定结束，化简时可以整个丢弃
+    virtual bool isPure() const { return false; }
+
+    // 运算符节点（二元、一元、赋值）的子树用显式栈遍历（见 post_order），节点只提供单步操作：
+    // 把直接子节点（最多两个）写入 Ops 并返回个数，非运算符节点返回 0
+    virtual unsigned getOperands(BaseAST ** /*Ops*/) const { return 0; }
+    // 由子节点的值生成自身
+    virtual llvm::Value *emitNode(llvm::Value ** /*Vals*/) { return 0; }
+    // 换上化简后的子节点，再化简自身
+    virtual BaseAST *simplifyNode(BaseAST ** /*Ops*/) { return this; }
+    // 子节点已在池中，写入自身
+    virtual unsigned flattenNode(FlatAST & /*Pool*/, const unsigned * /*Ops*/) const { return 0; }
+    // 子节点都是纯的时自身是否是纯的
+    virtual bool isPureNode() const { return false; }
 };
 
-llvm::Value *FunctionCallAST::codegen()
-{
-    llvm::Function *CalleeF = Module_ob->getFunction(Function_Callee);
-    std::vector<llvm::Value *> ArgsV;
-
-    for (unsigned i = 0, e = Function_Arguments.size(); i != e; ++i)
-    {
-        ArgsV.push_back(Function_Arguments[i]->codegen());
-        if (ArgsV.back() == 0)
-            return 0;
-    }
+// 只由 AST 化简产生的内部运算符：自定义运算符必须是 ASCII 字符，不会与它们冲突
+static const char OP_SHL = (char)0x80;
+static const char OP_LSHR = (char)0x81;
 
-    return Builder.CreateCall(CalleeF, ArgsV, "calltmp");
+static bool is_builtin_operator(char Op)
+{
+    return Op == '<' || Op == '+' || Op == '-' || Op == '*' || Op == '/' || Op == OP_SHL || Op == OP_LSHR;
 }
 
-class ExprIfAST : public BaseAST
+// 一个顶层项（def 或顶层表达式）的所有 AST 节点都从同一个 bump-pointer 区域中连续分配，
+// 该顶层项的 codegen 完成后调用 reset() 一次性析构并释放
+class ASTArena
 {
-    BaseAST *Cond, *Then, *Else;
+    llvm::BumpPtrAllocator Allocator;
+    // 节点内部仍有 std::string/std::vector，需要在释放前逐个析构
+    std::vector<std::pair<void *, void (*)(void *)>> Destructors;
+    size_t Peak_Bytes = 0;
+    size_t Total_Bytes = 0;
+    unsigned Num_Items = 0;
+    // 解析器创建后又换掉、不在树中的节点数
+    size_t Num_Discarded = 0;
+
+    template <typename T>
+    static void destroy(void *P) { static_cast<T *>(P)->~T(); }
 
 public:
-    ExprIfAST(BaseAST *cond, BaseAST *then, BaseAST *else_st) : Cond(cond), Then(then), Else(else_st) {}
-    llvm::Value *codegen() override;
+    template <typename T, typename... ArgTypes>
+    T *create(ArgTypes &&... Args)
+    {
+        T *Node = new (Allocator.Allocate<T>()) T(std::forward<ArgTypes>(Args)...);
+        Destructors.push_back(std::make_pair(static_cast<void *>(Node), &destroy<T>));
+        return Node;
+    }
+
+    void reset()
+    {
+        count_phase(PHASE_PARSE, Destructors.size());
+        for (size_t i = Destructors.size(); i != 0; --i)
+            Destructors[i - 1].second(Destructors[i - 1].first);
+        Destructors.clear();
+        Num_Discarded = 0;
+
+        size_t Bytes = Allocator.getBytesAllocated();
+        Peak_Bytes = std::max(Peak_Bytes, Bytes);
+        Total_Bytes += Bytes;
+        ++Num_Items;
+        Allocator.Reset();
+    }
+
+    // 节点已被换掉，不再计入 getNumNodes（仍随区域一起释放）
+    void discard() { ++Num_Discarded; }
+    // 自上次 reset 以来创建、仍可能在树中的节点数
+    size_t getNumNodes() const { return Destructors.size() - Num_Discarded; }
+    size_t getPeakBytes() const { return Peak_Bytes; }
+    size_t getTotalBytes() const { return Total_Bytes; }
+    unsigned getNumItems() const { return Num_Items; }
 };
 
-llvm::Value *ExprIfAST::codegen()
-{
-    llvm::Value *Condtn = Cond->codegen();
-    if (Condtn == 0)
-        return 0;
-    Condtn = Builder.CreateICmpNE(Condtn, Builder.getInt32(0), "ifcond");
+static ASTArena AST_Arena;
 
-    llvm::Function *TheFunc = Builder.GetInsertBlock()->getParent();
-    llvm::BasicBlock *ThenBB = llvm::BasicBlock::Create(TheGlobalContext, "then", TheFunc);
-    llvm::BasicBlock *ElseBB = llvm::BasicBlock::Create(TheGlobalContext, "else");
-    llvm::BasicBlock *MergeBB = llvm::BasicBlock::Create(TheGlobalContext, "ifcont");
+// 各类表达式的 IR 生成逻辑。指针 AST 和扁平 AST 共用这些函数，区别只在子节点如何生成：
+// Child 是子节点句柄（BaseAST * 或扁平池中的下标），Gen(Child) 为其生成代码。
+// 表达式的类型在解析时确定，这里按需插入隐式转换。
 
-    Builder.CreateCondBr(Condtn, ThenBB, ElseBB);
+// 变量都放在函数入口块的栈槽中，由 mem2reg 提升回寄存器（它只提升入口块里的 alloca）
+static llvm::AllocaInst *create_entry_alloca(llvm::Function *TheFunction, llvm::StringRef Name, ValueType Ty)
+{
+    llvm::BasicBlock &Entry = TheFunction->getEntryBlock();
+    llvm::IRBuilder<> Tmp(&Entry, Entry.begin());
+    return Tmp.CreateAlloca(get_llvm_type(Ty), nullptr, Name);
+}
 
-    Builder.SetInsertPoint(ThenBB);
-    llvm::Value *ThenV = Then->codegen();
-    if (!ThenV)
+// 隐式转换：int 按无符号数与 double 互转，标量复制到 vec4 的 4 个分量；vec4 不能转成标量
+static llvm::Value *convert_value(llvm::Value *V, ValueType To)
+{
+    if (V == 0)
         return 0;
-    Builder.CreateBr(MergeBB);
-    // 这条语句加不加都一样，并没有修改ThenBB的值
-    ThenBB = Builder.GetInsertBlock();
 
-    TheFunc->getBasicBlockList().push_back(ElseBB);
-    Builder.SetInsertPoint(ElseBB);
-    llvm::Value *ElseV = Else->codegen();
-    if (!ElseV)
+    ValueType From = get_value_type(V->getType());
+    if (From == To)
+        return V;
+    if (!can_convert(From, To))
         return 0;
-    Builder.CreateBr(MergeBB);
-    // 这条语句加不加都一样，并没有修改ThenBB的值
-    ElseBB = Builder.GetInsertBlock();
 
-    TheFunc->getBasicBlockList().push_back(MergeBB);
-    Builder.SetInsertPoint(MergeBB);
-    llvm::PHINode *PN = Builder.CreatePHI(llvm::Type::getInt32Ty(TheGlobalContext), 2, "iftmp");
-
-    PN->addIncoming(ThenV, ThenBB);
-    PN->addIncoming(ElseV, ElseBB);
-    return PN;
+    if (To == TYPE_INT)
+        return Builder->CreateFPToUI(V, Builder->getInt32Ty(), "fptoint");
+    if (From == TYPE_INT)
+        V = Builder->CreateUIToFP(V, Builder->getDoubleTy(), "inttofp");
+    if (To == TYPE_VEC4)
+        V = Builder->CreateVectorSplat(4, V, "splat");
+    return V;
 }
 
-class ExprForAST : public BaseAST
+// if/for 的条件：不等于 0 为真
+static llvm::Value *emit_condition(llvm::Value *V, const char *Name)
 {
-    std::string Var_Name;
-    BaseAST *Start, *Step, *End, *Body;
+    if (V == 0)
+        return 0;
 
-public:
-    ExprForAST(const std::string &var_name,
-               BaseAST *start,
-               BaseAST *step,
-               BaseAST *end,
-               BaseAST *body) : Var_Name(var_name), Start(start), Step(step), End(end), Body(body) {}
-    llvm::Value *codegen() override;
-};
+    switch (get_value_type(V->getType()))
+    {
+    case TYPE_INT:
+        return Builder->CreateICmpNE(V, Builder->getInt32(0), Name);
+    case TYPE_DOUBLE:
+        return Builder->CreateFCmpONE(V, llvm::ConstantFP::get(V->getType(), 0.0), Name);
+    default:
+        return 0;
+    }
+}
 
-llvm::Value *ExprForAST::codegen()
+static llvm::Value *emit_variable(unsigned Var_Id, ValueType Ty)
 {
-    llvm::Value *StartVal = Start->codegen();
-    if (StartVal == 0)
+    llvm::Value *Slot = Named_Values.lookup(Var_Id);
+    if (Slot == 0)
         return 0;
+    return Builder->CreateLoad(get_llvm_type(Ty), Slot, Identifiers.getName(Var_Id));
+}
 
-    llvm::Function *TheFunction = Builder.GetInsertBlock()->getParent();
-    llvm::BasicBlock *PreheaderBB = Builder.GetInsertBlock();
-    llvm::BasicBlock *LoopBB = llvm::BasicBlock::Create(TheGlobalContext, "loop", TheFunction);
-
-    // 直接跳到循环体LoopBB
-    Builder.CreateBr(LoopBB);
+// 赋值表达式的值就是转换成变量类型后被赋的值
+static llvm::Value *emit_assign(unsigned Var_Id, ValueType Ty, llvm::Value *Val)
+{
+    Val = convert_value(Val, Ty);
+    if (Val == 0)
+        return 0;
+    llvm::Value *Slot = Named_Values.lookup(Var_Id);
+    if (Slot == 0)
+        return 0;
+    Builder->CreateStore(Val, Slot);
+    return Val;
+}
 
-    Builder.SetInsertPoint(LoopBB);
-    llvm::PHINode *Variable = Builder.CreatePHI(llvm::Type::getInt32Ty(TheGlobalContext), 2, Var_Name.c_str());
-    // 来自初始条件
-    Variable->addIncoming(StartVal, PreheaderBB);
+static llvm::Value *emit_numeric(int Val)
+{
+    return llvm::ConstantInt::get(llvm::Type::getInt32Ty(*TheContext), Val);
+}
 
-    llvm::Value *OldVal = Named_Values[Var_Name];
-    Named_Values[Var_Name] = Variable;
+static llvm::Value *emit_fp_numeric(double Val)
+{
+    return llvm::ConstantFP::get(llvm::Type::getDoubleTy(*TheContext), Val);
+}
 
-    // 循环体的生成
-    if (Body->codegen() == 0)
+// 按函数的参数类型转换实参后调用
+static llvm::Value *emit_call_to(llvm::Function *F, llvm::ArrayRef<llvm::Value *> Args, const char *Name)
+{
+    if (F->arg_size() != Args.size())
         return 0;
 
-    // 步进条件的生成
-    llvm::Value *StepVal;
-    if (Step)
+    llvm::SmallVector<llvm::Value *, 4> ArgsV;
+    for (unsigned i = 0, e = Args.size(); i != e; ++i)
     {
-        // 步进值的生成
-        StepVal = Step->codegen();
-        if (StepVal == 0)
+        ArgsV.push_back(convert_value(Args[i], get_value_type(F->getArg(i)->getType())));
+        if (ArgsV.back() == 0)
             return 0;
     }
-    else
-    {
-        // 默认情况下，步进为1
-        StepVal = llvm::ConstantInt::get(llvm::Type::getInt32Ty(TheGlobalContext), 1);
-    }
+    return Builder->CreateCall(F, ArgsV, Name);
+}
 
-    // 步进代码的生成
-    llvm::Value *NextVar = Builder.CreateAdd(Variable, StepVal, "nextvar");
-    // 循环判断条件的生成
-    llvm::Value *EndCond = End->codegen();
-    if (EndCond == 0)
+static llvm::Value *emit_binary(char Op, llvm::Value *L, llvm::Value *R)
+{
+    if (L == 0 || R == 0)
         return 0;
 
-    // 不满足循环判断条件，跳转到循环结束代码
-    EndCond =
-        Builder.CreateICmpNE(EndCond, llvm::ConstantInt::get(llvm::Type::getInt32Ty(TheGlobalContext), 0), "loopcond");
+    if (Op == OP_SHL)
+        return Builder->CreateShl(L, R, "shltmp");
+    if (Op == OP_LSHR)
+        return Builder->CreateLShr(L, R, "shrtmp");
 
-    llvm::BasicBlock *LoopEndBB = Builder.GetInsertBlock();
-    llvm::BasicBlock *AfterBB = llvm::BasicBlock::Create(TheGlobalContext, "afterloop", TheFunction);
-    Builder.CreateCondBr(EndCond, LoopBB, AfterBB);
-    Builder.SetInsertPoint(AfterBB);
-    // 来自循环体
-    Variable->addIncoming(NextVar, LoopEndBB);
+    if (is_builtin_operator(Op))
+    {
+        // 内置运算符先把两侧转换到较宽的类型：int < double < vec4
+        ValueType Ty = std::max(get_value_type(L->getType()), get_value_type(R->getType()));
+        L = convert_value(L, Ty);
+        R = convert_value(R, Ty);
 
-    if (OldVal)
-        Named_Values[Var_Name] = OldVal;
-    else
-        Named_Values.erase(Var_Name);
+        if (Ty == TYPE_INT)
+        {
+            switch (Op)
+            {
+            case '<':
+                L = Builder->CreateICmpULT(L, R, "cmptmp");
+                return Builder->CreateZExt(L, llvm::Type::getInt32Ty(*TheContext), "booltmp");
+            case '+':
+                return Builder->CreateAdd(L, R, "addtmp");
+            case '-':
+                return Builder->CreateSub(L, R, "subtmp");
+            case '*':
+                return Builder->CreateMul(L, R, "multmp");
+            case '/':
+                return Builder->CreateUDiv(L, R, "divtmp");
+            }
+        }
 
-    return llvm::ConstantInt::getNullValue(llvm::Type::getInt32Ty(TheGlobalContext));
+        switch (Op)
+        {
+        case '<':
+            // double 比较得到 int 的 0/1，vec4 逐分量比较得到 0.0/1.0
+            L = Builder->CreateFCmpULT(L, R, "cmptmp");
+            if (Ty == TYPE_VEC4)
+                return Builder->CreateUIToFP(L, get_llvm_type(TYPE_VEC4), "booltmp");
+            return Builder->CreateZExt(L, llvm::Type::getInt32Ty(*TheContext), "booltmp");
+        case '+':
+            return Builder->CreateFAdd(L, R, "addtmp");
+        case '-':
+            return Builder->CreateFSub(L, R, "subtmp");
+        case '*':
+            return Builder->CreateFMul(L, R, "multmp");
+        case '/':
+            return Builder->CreateFDiv(L, R, "divtmp");
+        }
+    }
+
+    llvm::Function *F = getOperatorFunction(Binary_Operator_Fns, "binary", Op);
+    if (F == nullptr)
+        return nullptr;
+    llvm::Value *Ops[2] = {L, R};
+    return emit_call_to(F, Ops, "binop");
+}
+
+static llvm::Value *emit_unary(char Opcode, llvm::Value *OperandV)
+{
+    if (OperandV == 0)
+        return 0;
+
+    llvm::Function *F = getOperatorFunction(Unary_Operator_Fns, "unary", Opcode);
+    if (F == nullptr)
+        return nullptr;
+
+    return emit_call_to(F, OperandV, "tmp");
+}
+
+template <typename Child, typename GenFn>
+static llvm::Value *emit_call(const std::string &Callee, const Child *Args, unsigned Num_Args, GenFn Gen)
+{
+    llvm::Function *CalleeF = getFunction(Callee);
+    if (CalleeF == 0)
+        return 0;
+    std::vector<llvm::Value *> ArgsV;
+
+    for (unsigned i = 0; i != Num_Args; ++i)
+    {
+        ArgsV.push_back(Gen(Args[i]));
+        if (ArgsV.back() == 0)
+            return 0;
+    }
+
+    return emit_call_to(CalleeF, ArgsV, "calltmp");
+}
+
+// int(x)、double(x) 转换，vec4(x) 复制到 4 个分量，vec4(a, b, c, d) 逐个分量构造
+template <typename Child, typename GenFn>
+static llvm::Value *emit_construct(ValueType Ty, const Child *Args, unsigned Num_Args, GenFn Gen)
+{
+    if (Num_Args == 1)
+        return convert_value(Gen(Args[0]), Ty);
+
+    llvm::Value *V = llvm::UndefValue::get(get_llvm_type(Ty));
+    for (unsigned i = 0; i != Num_Args; ++i)
+    {
+        llvm::Value *Lane = convert_value(Gen(Args[i]), TYPE_DOUBLE);
+        if (Lane == 0)
+            return 0;
+        V = Builder->CreateInsertElement(V, Lane, i, "vecinit");
+    }
+    return V;
+}
+
+// 缓冲区第 Index 个元素的地址；下标是无符号 int，零扩展到 64 位
+static llvm::Value *emit_element_address(llvm::Value *Buffer, llvm::Value *Index)
+{
+    Index = convert_value(Index, TYPE_INT);
+    if (Buffer == 0 || Index == 0)
+        return 0;
+    Index = Builder->CreateZExt(Index, Builder->getInt64Ty(), "idxprom");
+    return Builder->CreateInBoundsGEP(Buffer->getType()->getPointerElementType(), Buffer, Index, "eltaddr");
+}
+
+// v[i] 取 vec4 的分量，a[i] 读缓冲区的元素
+static llvm::Value *emit_index(llvm::Value *Vec, llvm::Value *Index)
+{
+    if (Vec && Vec->getType()->isPointerTy())
+    {
+        llvm::Value *Addr = emit_element_address(Vec, Index);
+        if (Addr == 0)
+            return 0;
+        return Builder->CreateLoad(Vec->getType()->getPointerElementType(), Addr, "elt");
+    }
+
+    Index = convert_value(Index, TYPE_INT);
+    if (Vec == 0 || Index == 0)
+        return 0;
+    return Builder->CreateExtractElement(Vec, Index, "lane");
+}
+
+// a[i] = x：按元素类型转换后写入，值为写入的值
+static llvm::Value *emit_store(llvm::Value *Buffer, llvm::Value *Index, llvm::Value *Val)
+{
+    llvm::Value *Addr = emit_element_address(Buffer, Index);
+    if (Addr == 0 || Val == 0)
+        return 0;
+    Val = convert_value(Val, get_value_type(Addr->getType()->getPointerElementType()));
+    if (Val == 0)
+        return 0;
+    Builder->CreateStore(Val, Addr);
+    return Val;
+}
+
+template <typename Child, typename GenFn>
+static llvm::Value *emit_if(Child Cond, Child Then, Child Else, ValueType Ty, GenFn Gen)
+{
+    llvm::Value *Condtn = emit_condition(Gen(Cond), "ifcond");
+    if (Condtn == 0)
+        return 0;
+
+    llvm::Function *TheFunc = Builder->GetInsertBlock()->getParent();
+    llvm::BasicBlock *ThenBB = llvm::BasicBlock::Create(*TheContext, "then", TheFunc);
+    llvm::BasicBlock *ElseBB = llvm::BasicBlock::Create(*TheContext, "else");
+    llvm::BasicBlock *MergeBB = llvm::BasicBlock::Create(*TheContext, "ifcont");
+
+    Builder->CreateCondBr(Condtn, ThenBB, ElseBB);
+
+    Builder->SetInsertPoint(ThenBB);
+    llvm::Value *ThenV = convert_value(Gen(Then), Ty);
+    if (!ThenV)
+        return 0;
+    Builder->CreateBr(MergeBB);
+    // 这条语句加不加都一样，并没有修改ThenBB的值
+    ThenBB = Builder->GetInsertBlock();
+
+    TheFunc->getBasicBlockList().push_back(ElseBB);
+    Builder->SetInsertPoint(ElseBB);
+    llvm::Value *ElseV = convert_value(Gen(Else), Ty);
+    if (!ElseV)
+        return 0;
+    Builder->CreateBr(MergeBB);
+    // 这条语句加不加都一样，并没有修改ThenBB的值
+    ElseBB = Builder->GetInsertBlock();
+
+    TheFunc->getBasicBlockList().push_back(MergeBB);
+    Builder->SetInsertPoint(MergeBB);
+    llvm::PHINode *PN = Builder->CreatePHI(get_llvm_type(Ty), 2, "iftmp");
+
+    PN->addIncoming(ThenV, ThenBB);
+    PN->addIncoming(ElseV, ElseBB);
+    return PN;
+}
+
+template <typename Child, typename GenFn>
+static llvm::Value *emit_for(unsigned Var_Id, Child Start, Child Step, bool Has_Step, Child End, Child Body, GenFn Gen)
+{
+    llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    llvm::AllocaInst *Alloca = create_entry_alloca(TheFunction, Identifiers.getName(Var_Id), TYPE_INT);
+
+    // 循环变量总是 int
+    llvm::Value *StartVal = convert_value(Gen(Start), TYPE_INT);
+    if (StartVal == 0)
+        return 0;
+    Builder->CreateStore(StartVal, Alloca);
+
+    llvm::BasicBlock *LoopBB = llvm::BasicBlock::Create(*TheContext, "loop", TheFunction);
+
+    // 直接跳到循环体LoopBB
+    Builder->CreateBr(LoopBB);
+
+    Builder->SetInsertPoint(LoopBB);
+
+    // 循环变量遮蔽同名的外层变量，离开循环时恢复
+    size_t Scope = Named_Values.enterScope();
+    Named_Values.bind(Var_Id, Alloca);
+
+    // 循环体的生成
+    if (Gen(Body) == 0)
+        return 0;
+
+    // 步进条件的生成
+    llvm::Value *StepVal;
+    if (Has_Step)
+    {
+        // 步进值的生成
+        StepVal = convert_value(Gen(Step), TYPE_INT);
+        if (StepVal == 0)
+            return 0;
+    }
+    else
+    {
+        // 默认情况下，步进为1
+        StepVal = llvm::ConstantInt::get(llvm::Type::getInt32Ty(*TheContext), 1);
+    }
+
+    // 循环判断条件的生成，此时循环变量仍是本轮的值；不满足时跳转到循环结束代码
+    llvm::Value *EndCond = emit_condition(Gen(End), "loopcond");
+    if (EndCond == 0)
+        return 0;
+
+    // 步进代码的生成：循环体可能给循环变量赋过值，重新读出再加
+    llvm::Value *CurVar = Builder->CreateLoad(llvm::Type::getInt32Ty(*TheContext), Alloca, Identifiers.getName(Var_Id));
+    llvm::Value *NextVar = Builder->CreateAdd(CurVar, StepVal, "nextvar");
+    Builder->CreateStore(NextVar, Alloca);
+
+    llvm::BasicBlock *AfterBB = llvm::BasicBlock::Create(*TheContext, "afterloop", TheFunction);
+    Builder->CreateCondBr(EndCond, LoopBB, AfterBB);
+    Builder->SetInsertPoint(AfterBB);
+
+    Named_Values.leaveScope(Scope);
+
+    return llvm::ConstantInt::getNullValue(llvm::Type::getInt32Ty(*TheContext));
+}
+
+// var a = 1, double b in Body：依次求初值并绑定，后面的初值能看到前面的变量；没有初值的变量为 0
+template <typename Child, typename GenFn>
+static llvm::Value *emit_var(const unsigned *Var_Ids, const ValueType *Var_Types, const Child *Inits, unsigned Num_Vars,
+                             Child No_Init, Child Body, GenFn Gen)
+{
+    llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    size_t Scope = Named_Values.enterScope();
+
+    for (unsigned i = 0; i != Num_Vars; ++i)
+    {
+        llvm::Type *Ty = get_llvm_type(Var_Types[i]);
+        llvm::Value *InitVal =
+            Inits[i] == No_Init ? llvm::Constant::getNullValue(Ty) : convert_value(Gen(Inits[i]), Var_Types[i]);
+        if (InitVal == 0)
+            return 0;
+
+        llvm::AllocaInst *Alloca = create_entry_alloca(TheFunction, Identifiers.getName(Var_Ids[i]), Var_Types[i]);
+        Builder->CreateStore(InitVal, Alloca);
+        Named_Values.bind(Var_Ids[i], Alloca);
+    }
+
+    llvm::Value *BodyVal = Gen(Body);
+    Named_Values.leaveScope(Scope);
+    return BodyVal;
+}
+
+// 扁平 AST：一个函数体的全部节点按后序存放在连续的 vector 中，子节点用下标引用，
+// 代码生成用 switch 代替虚函数分派，深层表达式树因此在连续内存上遍历。
+class FlatAST
+{
+public:
+    enum NodeKind : unsigned char
+    {
+        FLAT_NUMERIC,
+        FLAT_FP_NUMERIC,
+        FLAT_VARIABLE,
+        FLAT_BINARY,
+        FLAT_UNARY,
+        FLAT_CALL,
+        FLAT_IF,
+        FLAT_FOR,
+        FLAT_VAR,
+        FLAT_ASSIGN,
+        FLAT_CONSTRUCT,
+        FLAT_INDEX,
+        FLAT_STORE
+    };
+
+    // FLAT_VAR 中没有初值的变量
+    static const unsigned NO_INIT = ~0u;
+
+    struct Node
+    {
+        NodeKind Kind;
+        ValueType Ty;   // 节点的类型
+        char Op;        // FLAT_BINARY/FLAT_UNARY 的运算符
+        int Value;      // FLAT_NUMERIC 的值，FLAT_VARIABLE/FLAT_FOR/FLAT_ASSIGN 的符号编号，
+                        // FLAT_FP_NUMERIC 在 FP_Constants、FLAT_CALL 在 Names、FLAT_VAR 在 Types 中的下标
+        unsigned First; // 操作数在 Operands 中的起始位置
+        unsigned Num_Ops;
+    };
+
+private:
+    std::vector<Node> Nodes;
+    std::vector<unsigned> Operands;
+    std::vector<std::string> Names;
+    std::vector<double> FP_Constants;
+    std::vector<ValueType> Types;
+
+public:
+    void clear()
+    {
+        Nodes.clear();
+        Operands.clear();
+        Names.clear();
+        FP_Constants.clear();
+        Types.clear();
+    }
+
+    size_t size() const { return Nodes.size(); }
+
+    unsigned add(NodeKind Kind, ValueType Ty, char Op, int Value, const unsigned *Ops, unsigned Num_Ops)
+    {
+        Node N = {Kind, Ty, Op, Value, (unsigned)Operands.size(), Num_Ops};
+        Operands.insert(Operands.end(), Ops, Ops + Num_Ops);
+        Nodes.push_back(N);
+        return Nodes.size() - 1;
+    }
+
+    int addName(const std::string &Name)
+    {
+        Names.push_back(Name);
+        return Names.size() - 1;
+    }
+
+    int addFPConstant(double Val)
+    {
+        FP_Constants.push_back(Val);
+        return FP_Constants.size() - 1;
+    }
+
+    int addTypes(const std::vector<ValueType> &Tys)
+    {
+        Types.insert(Types.end(), Tys.begin(), Tys.end());
+        return Types.size() - Tys.size();
+    }
+
+    static bool is_operator(NodeKind Kind) { return Kind == FLAT_BINARY || Kind == FLAT_UNARY || Kind == FLAT_ASSIGN; }
+
+    // 运算符节点组成的子树用显式栈按后序生成，其余节点交给 codegenNode
+    llvm::Value *codegen(unsigned Idx)
+    {
+        if (!is_operator(Nodes[Idx].Kind))
+            return codegenNode(Idx);
+
+        llvm::SmallVector<std::pair<unsigned, unsigned>, 16> Stack; // 节点下标和下一个要生成的操作数
+        llvm::SmallVector<llvm::Value *, 16> Values;
+        Stack.push_back(std::make_pair(Idx, 0u));
+        while (!Stack.empty())
+        {
+            const Node &N = Nodes[Stack.back().first];
+            if (Stack.back().second != N.Num_Ops)
+            {
+                unsigned Op = Operands[N.First + Stack.back().second++];
+                if (is_operator(Nodes[Op].Kind))
+                    Stack.push_back(std::make_pair(Op, 0u));
+                else
+                    Values.push_back(codegenNode(Op));
+                continue;
+            }
+
+            llvm::Value **Vals = Values.end() - N.Num_Ops;
+            llvm::Value *V;
+            if (N.Kind == FLAT_BINARY)
+                V = emit_binary(N.Op, Vals[0], Vals[1]);
+            else if (N.Kind == FLAT_UNARY)
+                V = emit_unary(N.Op, Vals[0]);
+            else
+                V = emit_assign(N.Value, N.Ty, Vals[0]);
+            Values.resize(Values.size() - N.Num_Ops);
+            Values.push_back(V);
+            Stack.pop_back();
+        }
+        return Values.back();
+    }
+
+private:
+    llvm::Value *codegenNode(unsigned Idx)
+    {
+        const Node &N = Nodes[Idx];
+        const unsigned *Ops = Operands.data() + N.First;
+        auto Gen = [this](unsigned I) { return codegen(I); };
+
+        switch (N.Kind)
+        {
+        case FLAT_NUMERIC:
+            return emit_numeric(N.Value);
+        case FLAT_FP_NUMERIC:
+            return emit_fp_numeric(FP_Constants[N.Value]);
+        case FLAT_VARIABLE:
+            return emit_variable(N.Value, N.Ty);
+        case FLAT_CALL:
+            return emit_call(Names[N.Value], Ops, N.Num_Ops, Gen);
+        case FLAT_IF:
+            return emit_if(Ops[0], Ops[1], Ops[2], N.Ty, Gen);
+        case FLAT_FOR:
+            // 操作数依次为 Start、End、Body，有步进时 Step 排在最后
+            return emit_for(N.Value, Ops[0], N.Num_Ops == 4 ? Ops[3] : 0, N.Num_Ops == 4, Ops[1], Ops[2], Gen);
+        case FLAT_VAR:
+        {
+            // 操作数依次为 n 个初值、Body、n 个变量的符号编号，变量的类型在 Types 中
+            unsigned Num_Vars = N.Num_Ops / 2;
+            return emit_var(Ops + Num_Vars + 1, Types.data() + N.Value, Ops, Num_Vars, NO_INIT, Ops[Num_Vars], Gen);
+        }
+        case FLAT_CONSTRUCT:
+            return emit_construct(N.Ty, Ops, N.Num_Ops, Gen);
+        case FLAT_INDEX:
+        {
+            llvm::Value *Vec = codegen(Ops[0]);
+            return emit_index(Vec, codegen(Ops[1]));
+        }
+        case FLAT_STORE:
+        {
+            llvm::Value *Buffer = codegen(Ops[0]);
+            llvm::Value *Index = codegen(Ops[1]);
+            return emit_store(Buffer, Index, codegen(Ops[2]));
+        }
+        default:
+            // 运算符节点由 codegen 处理
+            return 0;
+        }
+    }
+};
+
+static thread_local FlatAST Flat_Pool;
+
+// 运算符节点子树的后序遍历：非运算符节点交给 Leaf（其内部按各自的方式处理子节点），
+// 运算符节点在子节点的结果都就绪后交给 Combine。栈帧和中间结果都在显式栈上，
+// 百万项的运算符链也不会耗尽本机栈。
+template <typename R, typename LeafFn, typename CombineFn>
+static R post_order(BaseAST *Root, LeafFn Leaf, CombineFn Combine)
+{
+    struct Frame
+    {
+        BaseAST *Node;
+        BaseAST *Ops[2];
+        unsigned Num_Ops, Next;
+    };
+    llvm::SmallVector<Frame, 16> Stack;
+    llvm::SmallVector<R, 16> Results;
+
+    auto visit = [&](BaseAST *N)
+    {
+        Frame F = {N, {nullptr, nullptr}, 0, 0};
+        F.Num_Ops = N->getOperands(F.Ops);
+        if (F.Num_Ops == 0)
+            Results.push_back(Leaf(N));
+        else
+            Stack.push_back(F);
+    };
+
+    visit(Root);
+    while (!Stack.empty())
+    {
+        Frame &F = Stack.back();
+        if (F.Next != F.Num_Ops)
+        {
+            visit(F.Ops[F.Next++]);
+            continue;
+        }
+        R V = Combine(F.Node, Results.end() - F.Num_Ops);
+        Results.resize(Results.size() - F.Num_Ops);
+        Stack.pop_back();
+        Results.push_back(V);
+    }
+    return Results.back();
+}
+
+static llvm::Value *codegen_tree(BaseAST *Root)
+{
+    return post_order<llvm::Value *>(
+        Root, [](BaseAST *N) { return N->codegen(); },
+        [](BaseAST *N, llvm::Value **Vals) { return N->emitNode(Vals); });
+}
+
+static BaseAST *simplify_tree(BaseAST *Root)
+{
+    return post_order<BaseAST *>(
+        Root, [](BaseAST *N) { return N->simplify(); },
+        [](BaseAST *N, BaseAST **Ops) { return N->simplifyNode(Ops); });
+}
+
+// 只读遍历，不会修改节点
+static unsigned flatten_tree(const BaseAST *Root, FlatAST &Pool)
+{
+    return post_order<unsigned>(
+        const_cast<BaseAST *>(Root), [&Pool](BaseAST *N) { return N->flatten(Pool); },
+        [&Pool](BaseAST *N, unsigned *Ops) { return N->flattenNode(Pool, Ops); });
+}
+
+static bool pure_tree(const BaseAST *Root)
+{
+    llvm::SmallVector<BaseAST *, 16> Work;
+    Work.push_back(const_cast<BaseAST *>(Root));
+    while (!Work.empty())
+    {
+        BaseAST *N = Work.pop_back_val();
+        BaseAST *Ops[2];
+        unsigned Num_Ops = N->getOperands(Ops);
+        if (Num_Ops == 0 ? !N->isPure() : !N->isPureNode())
+            return false;
+        Work.append(Ops, Ops + Num_Ops);
+    }
+    return true;
+}
+
+class VariableAST : public BaseAST
+{
+    unsigned Var_Id;
+    bool Bound;
+
+public:
+    VariableAST(unsigned id, ValueType ty, bool bound = true) : BaseAST(ty), Var_Id(id), Bound(bound) {}
+    unsigned getId() const { return Var_Id; }
+    virtual llvm::Value *codegen();
+    unsigned flatten(FlatAST &Pool) const override;
+    // 未绑定的变量在代码生成时会报错，不能被化简掉
+    bool isPure() const override { return Bound; }
+};
+
+llvm::Value *VariableAST::codegen()
+{
+    return emit_variable(Var_Id, Ty);
+}
+
+unsigned VariableAST::flatten(FlatAST &Pool) const
+{
+    return Pool.add(FlatAST::FLAT_VARIABLE, Ty, 0, Var_Id, nullptr, 0);
+}
+
+class NumericAST : public BaseAST
+{
+    int numeric_val;
+    double fp_val;
+
+public:
+    NumericAST(int val) : BaseAST(TYPE_INT), numeric_val(val), fp_val(0) {}
+    NumericAST(double val) : BaseAST(TYPE_DOUBLE), numeric_val(0), fp_val(val) {}
+    int getValue() const { return numeric_val; }
+    double getFPValue() const { return fp_val; }
+    // 作为条件时是否成立，与 emit_condition 一致：double 用 fcmp one，NaN 不成立
+    bool isTrue() const { return Ty == TYPE_INT ? numeric_val != 0 : fp_val != 0 && !std::isnan(fp_val); }
+    virtual llvm::Value *codegen();
+    unsigned flatten(FlatAST &Pool) const override;
+    bool isPure() const override { return true; }
+};
+
+llvm::Value *NumericAST::codegen()
+{
+    if (Ty == TYPE_DOUBLE)
+        return emit_fp_numeric(fp_val);
+    return emit_numeric(numeric_val);
+}
+
+unsigned NumericAST::flatten(FlatAST &Pool) const
+{
+    if (Ty == TYPE_DOUBLE)
+        return Pool.add(FlatAST::FLAT_FP_NUMERIC, Ty, 0, Pool.addFPConstant(fp_val), nullptr, 0);
+    return Pool.add(FlatAST::FLAT_NUMERIC, Ty, 0, numeric_val, nullptr, 0);
+}
+
+class BinaryAST : public BaseAST
+{
+    char Bin_Operator;
+    BaseAST *LHS, *RHS;
+
+public:
+    BinaryAST(char op, BaseAST *lhs, BaseAST *rhs, ValueType ty) : BaseAST(ty), Bin_Operator(op), LHS(lhs), RHS(rhs) {}
+    virtual llvm::Value *codegen() { return codegen_tree(this); }
+    unsigned flatten(FlatAST &Pool) const override { return flatten_tree(this, Pool); }
+    BaseAST *simplify() override { return simplify_tree(this); }
+    bool isPure() const override { return pure_tree(this); }
+
+    unsigned getOperands(BaseAST **Ops) const override
+    {
+        Ops[0] = LHS;
+        Ops[1] = RHS;
+        return 2;
+    }
+    llvm::Value *emitNode(llvm::Value **Vals) override { return emit_binary(Bin_Operator, Vals[0], Vals[1]); }
+    BaseAST *simplifyNode(BaseAST **Ops) override;
+    unsigned flattenNode(FlatAST &Pool, const unsigned *Ops) const override
+    {
+        return Pool.add(FlatAST::FLAT_BINARY, Ty, Bin_Operator, 0, Ops, 2);
+    }
+    bool isPureNode() const override { return is_builtin_operator(Bin_Operator); }
+};
+
+// 常量按 emit_binary 生成的指令的语义折叠（int 为 i32 无符号运算）；自定义运算符是函数调用，不折叠。
+// 代数化简和强度削减只用于两侧都是 int 的情况，double 上的 x*0 等并不恒等。
+BaseAST *BinaryAST::simplifyNode(BaseAST **Ops)
+{
+    LHS = Ops[0];
+    RHS = Ops[1];
+    if (!is_builtin_operator(Bin_Operator))
+        return this;
+
+    NumericAST *L = dynamic_cast<NumericAST *>(LHS);
+    NumericAST *R = dynamic_cast<NumericAST *>(RHS);
+    if (L && R && L->getType() == TYPE_DOUBLE && R->getType() == TYPE_DOUBLE)
+    {
+        double A = L->getFPValue(), B = R->getFPValue();
+        switch (Bin_Operator)
+        {
+        case '<':
+            return AST_Arena.create<NumericAST>((int)(A < B || A != A || B != B));
+        case '+':
+            return AST_Arena.create<NumericAST>(A + B);
+        case '-':
+            return AST_Arena.create<NumericAST>(A - B);
+        case '*':
+            return AST_Arena.create<NumericAST>(A * B);
+        case '/':
+            return AST_Arena.create<NumericAST>(A / B);
+        }
+        return this;
+    }
+    if (LHS->getType() != TYPE_INT || RHS->getType() != TYPE_INT)
+        return this;
+
+    if (L && R)
+    {
+        uint32_t A = L->getValue(), B = R->getValue();
+        switch (Bin_Operator)
+        {
+        case '<':
+            return AST_Arena.create<NumericAST>((int)(A < B));
+        case '+':
+            return AST_Arena.create<NumericAST>((int)(A + B));
+        case '-':
+            return AST_Arena.create<NumericAST>((int)(A - B));
+        case '*':
+            return AST_Arena.create<NumericAST>((int)(A * B));
+        case '/':
+            // 除以 0 留给运行时
+            if (B != 0)
+                return AST_Arena.create<NumericAST>((int)(A / B));
+            break;
+        }
+        return this;
+    }
+
+    if (R)
+    {
+        uint32_t B = R->getValue();
+        if (B == 0 && (Bin_Operator == '+' || Bin_Operator == '-'))
+            return LHS;
+        if (B == 1 && (Bin_Operator == '*' || Bin_Operator == '/'))
+            return LHS;
+        // x*0 和 x<0 的结果与 x 无关，x 没有副作用时整个丢弃
+        if (B == 0 && (Bin_Operator == '*' || Bin_Operator == '<') && LHS->isPure())
+            return R;
+        // 强度削减：乘除 2 的幂改为移位
+        if (llvm::isPowerOf2_32(B) && (Bin_Operator == '*' || Bin_Operator == '/'))
+        {
+            Bin_Operator = Bin_Operator == '*' ? OP_SHL : OP_LSHR;
+            RHS = AST_Arena.create<NumericAST>((int)llvm::Log2_32(B));
+        }
+    }
+    else if (L)
+    {
+        uint32_t A = L->getValue();
+        if (A == 0 && Bin_Operator == '+')
+            return RHS;
+        if (A == 1 && Bin_Operator == '*')
+            return RHS;
+        if (A == 0 && (Bin_Operator == '*' || Bin_Operator == '/') && RHS->isPure())
+            return L;
+        if (llvm::isPowerOf2_32(A) && Bin_Operator == '*')
+        {
+            Bin_Operator = OP_SHL;
+            LHS = RHS;
+            RHS = AST_Arena.create<NumericAST>((int)llvm::Log2_32(A));
+        }
+    }
+    return this;
+}
+
+class FunctionDeclAST
+{
+    std::string Func_Name;
+    std::vector<std::string> Arguments;
+    std::vector<unsigned> Argument_Ids;
+    std::vector<ValueType> Argument_Types;
+    ValueType Return_Type;
+    bool isOperator;
+    unsigned Precedence;
+
+public:
+    FunctionDeclAST(const std::string &name,
+                    const std::vector<std::string> &args,
+                    const std::vector<ValueType> &arg_types,
+                    ValueType ret_type,
+                    bool isoperator = false,
+                    unsigned prec = 0) : Func_Name(name), Arguments(args), Argument_Types(arg_types),
+                                         Return_Type(ret_type), isOperator(isoperator), Precedence(prec)
+    {
+        for (unsigned i = 0, e = Arguments.size(); i != e; ++i)
+            Argument_Ids.push_back(Identifiers.intern(Arguments[i]));
+    }
+
+    bool isUnaryOp() const { return isOperator && Arguments.size() == 1; }
+    bool isBinaryOp() const { return isOperator && Arguments.size() == 2; }
+
+    char getOperatorName() const
+    {
+        assert(isUnaryOp() || isBinaryOp());
+        return Func_Name[Func_Name.size() - 1];
+    }
+
+    unsigned getBinaryPrecedence() const
+    {
+        return Precedence;
+    }
+
+    const std::string &getName() const { return Func_Name; }
+    const std::vector<std::string> &getArguments() const { return Arguments; }
+    const std::vector<unsigned> &getArgumentIds() const { return Argument_Ids; }
+    const std::vector<ValueType> &getArgumentTypes() const { return Argument_Types; }
+    ValueType getReturnType() const { return Return_Type; }
+
+    virtual llvm::Function *codegen();
+};
+
+llvm::Function *FunctionDeclAST::codegen()
+{
+    std::vector<llvm::Type *> Params;
+    for (unsigned i = 0, e = Argument_Types.size(); i != e; ++i)
+        Params.push_back(get_llvm_type(Argument_Types[i]));
+    llvm::FunctionType *FT = llvm::FunctionType::get(get_llvm_type(Return_Type), Params, false);
+    llvm::Function *F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, Func_Name, Module_ob);
+
+    if (F->getName() != Func_Name)
+    {
+        F->eraseFromParent();
+        F = Module_ob->getFunction(Func_Name);
+        if (!F->empty())
+            return 0;
+        if (F->getFunctionType() != FT)
+            return 0;
+    }
+
+    unsigned Idx = 0;
+    for (llvm::Function::arg_iterator Arg_It = F->arg_begin(); Idx != Arguments.size(); ++Arg_It, ++Idx)
+        Arg_It->setName(Arguments[Idx]);
+
+    return F;
+}
+
+// 已经定义过的函数原型，JIT 模式下函数可能位于之前已提交的模块中
+// 原型从 AST 区域中复制出来保存，不随顶层项一起释放
+static std::map<std::string, std::unique_ptr<FunctionDeclAST>> Function_Protos;
+
+// -j 模式在解析阶段就登记全部原型。工作线程生成第 Current_Item 项时只能看到源码中排在它前面、
+// 并且生成成功的 def，与串行模式边解析边生成时看到的一致。值是定义该函数的各项的下标，按源码顺序
+static std::map<std::string, std::vector<size_t>> Proto_Items;
+// 串行模式下为 SIZE_MAX，所有已登记的原型都可见
+static thread_local size_t Current_Item = SIZE_MAX;
+// 每项生成时查找过的函数名，可见的原型改变后只需重新生成查找过它们的项
+static std::vector<std::vector<std::string>> Item_Callees;
+
+static bool proto_visible(const std::string &Name)
+{
+    if (Current_Item == SIZE_MAX)
+        return true;
+    std::map<std::string, std::vector<size_t>>::const_iterator It = Proto_Items.find(Name);
+    return It != Proto_Items.end() && !It->second.empty() && It->second.front() < Current_Item;
+}
+
+static llvm::Function *getFunction(const std::string &Name)
+{
+    if (Current_Item != SIZE_MAX)
+        Item_Callees[Current_Item].push_back(Name);
+    if (llvm::Function *F = Module_ob->getFunction(Name))
+        return F;
+
+    // 在当前模块中重新生成声明，由 JIT 在链接时解析到之前的定义
+    std::map<std::string, std::unique_ptr<FunctionDeclAST>>::iterator It = Function_Protos.find(Name);
+    if (It != Function_Protos.end() && proto_visible(Name))
+        return It->second->codegen();
+
+    return 0;
+}
+
+class FunctionDefnAST
+{
+    FunctionDeclAST *Func_Decl;
+    BaseAST *Body;
+
+public:
+    FunctionDefnAST(FunctionDeclAST *decl, BaseAST *body) : Func_Decl(decl), Body(body) {}
+    virtual llvm::Function *codegen();
+    void simplify(size_t Body_Nodes);
+    void registerPrototype();
+    void registerOperator();
+    const std::string &getName() const { return Func_Decl->getName(); }
+    ValueType getReturnType() const { return Func_Decl->getReturnType(); }
+};
+
+// 记录原型，后续模块据此重新声明该函数。codegen 不直接写 Function_Protos，
+// 由调用者在串行生成成功后、或 -j 模式在解析阶段调用，保证工作线程只读它。
+void FunctionDefnAST::registerPrototype()
+{
+    if (!Func_Decl->getName().empty())
+        Function_Protos[Func_Decl->getName()] = std::make_unique<FunctionDeclAST>(*Func_Decl);
+}
+
+// 运算符的优先级影响后续输入的解析，在 def 解析完成后立即登记
+void FunctionDefnAST::registerOperator()
+{
+    if (Func_Decl->isBinaryOp())
+        Operator_Precedence[(unsigned char)Func_Decl->getOperatorName()] = Func_Decl->getBinaryPrecedence();
+}
+
+static unsigned Simplify_Nodes_Before, Simplify_Nodes_After;
+
+static unsigned count_nodes(const BaseAST *E)
+{
+    static FlatAST Count_Pool;
+    Count_Pool.clear();
+    E->flatten(Count_Pool);
+    return Count_Pool.size();
+}
+
+// 在解析阶段化简函数体，串行、-j 和 -flat-ast 都从化简后的 AST 生成代码。
+// Body_Nodes 是解析函数体时在 AST_Arena 中创建的节点数，即化简前的节点数，不必再遍历一次
+void FunctionDefnAST::simplify(size_t Body_Nodes)
+{
+    if (!SimplifyAST)
+        return;
+    if (ReportSimplify)
+        Simplify_Nodes_Before += Body_Nodes;
+    Body = Body->simplify();
+    if (ReportSimplify)
+        Simplify_Nodes_After += count_nodes(Body);
+}
+
+llvm::Function *FunctionDefnAST::codegen()
+{
+    size_t Scope = Named_Values.enterScope();
+
+    // JIT 模式下允许重新定义（见 replace_definition），参数个数和类型都可能与旧定义不同，
+    // 只能按新的原型声明，不能经 getFunction 沿用 Function_Protos 中旧原型的签名
+    llvm::Function *TheFunction =
+        TheJIT ? Module_ob->getFunction(Func_Decl->getName()) : getFunction(Func_Decl->getName());
+    if (TheFunction == 0)
+        TheFunction = Func_Decl->codegen();
+    if (TheFunction == 0 || !TheFunction->empty())
+        return 0;
+
+    llvm::BasicBlock *BB = llvm::BasicBlock::Create(*TheContext, "entry", TheFunction);
+    Builder->SetInsertPoint(BB);
+
+    // 参数也存进栈槽，函数体才能给它们赋值
+    const std::vector<unsigned> &Argument_Ids = Func_Decl->getArgumentIds();
+    unsigned Idx = 0;
+    for (llvm::Function::arg_iterator Arg_It = TheFunction->arg_begin(); Idx != Argument_Ids.size(); ++Arg_It, ++Idx)
+    {
+        llvm::AllocaInst *Alloca =
+            create_entry_alloca(TheFunction, Arg_It->getName(), Func_Decl->getArgumentTypes()[Idx]);
+        Builder->CreateStore(&*Arg_It, Alloca);
+        Named_Values.bind(Argument_Ids[Idx], Alloca);
+    }
+
+    llvm::Value *RetVal;
+    {
+        PhaseTimer Timer(PHASE_CODEGEN);
+        if (UseFlatAST)
+        {
+            Flat_Pool.clear();
+            RetVal = Flat_Pool.codegen(Body->flatten(Flat_Pool));
+        }
+        else
+            RetVal = Body->codegen();
+        RetVal = convert_value(RetVal, Func_Decl->getReturnType());
+        if (RetVal)
+            Builder->CreateRet(RetVal);
+    }
+    Named_Values.leaveScope(Scope);
+
+    if (RetVal)
+    {
+        {
+            PhaseTimer Timer(PHASE_VERIFY);
+            verifyFunction(*TheFunction);
+        }
+        if (PhaseStats)
+        {
+            count_phase(PHASE_CODEGEN, TheFunction->getInstructionCount());
+            count_phase(PHASE_VERIFY, 1);
+        }
+
+        if (Global_FP)
+        {
+            {
+                PhaseTimer Timer(PHASE_OPTIMIZE);
+                Global_FP->run(*TheFunction, *Global_FAM);
+                // JIT 模式下模块会被释放，不能让缓存的分析结果指向已删除的函数
+                Global_FAM->clear(*TheFunction, TheFunction->getName());
+            }
+            ++Num_Optimized_Functions;
+            if (PhaseStats)
+                count_phase(PHASE_OPTIMIZE, TheFunction->getInstructionCount());
+        }
+        return TheFunction;
+    }
+
+    TheFunction->eraseFromParent();
+    // 运算符表中可能缓存了刚被删除的函数
+    reset_operator_tables();
+    return 0;
+}
+
+class FunctionCallAST : public BaseAST
+{
+    std::string Function_Callee;
+    std::vector<BaseAST *> Function_Arguments;
+
+public:
+    FunctionCallAST(const std::string &callee, std::vector<BaseAST *> &args, ValueType ty)
+        : BaseAST(ty), Function_Callee(callee), Function_Arguments(args) {}
+    virtual llvm::Value *codegen();
+    unsigned flatten(FlatAST &Pool) const override;
+    BaseAST *simplify() override;
+};
+
+llvm::Value *FunctionCallAST::codegen()
+{
+    return emit_call(Function_Callee, Function_Arguments.data(), Function_Arguments.size(),
+                     [](BaseAST *N) { return N->codegen(); });
+}
+
+unsigned FunctionCallAST::flatten(FlatAST &Pool) const
+{
+    std::vector<unsigned> Ops;
+    for (unsigned i = 0, e = Function_Arguments.size(); i != e; ++i)
+        Ops.push_back(Function_Arguments[i]->flatten(Pool));
+    return Pool.add(FlatAST::FLAT_CALL, Ty, 0, Pool.addName(Function_Callee), Ops.data(), Ops.size());
+}
+
+BaseAST *FunctionCallAST::simplify()
+{
+    for (unsigned i = 0, e = Function_Arguments.size(); i != e; ++i)
+        Function_Arguments[i] = Function_Arguments[i]->simplify();
+    return this;
+}
+
+class ExprIfAST : public BaseAST
+{
+    BaseAST *Cond, *Then, *Else;
+
+public:
+    ExprIfAST(BaseAST *cond, BaseAST *then, BaseAST *else_st, ValueType ty)
+        : BaseAST(ty), Cond(cond), Then(then), Else(else_st) {}
+    llvm::Value *codegen() override;
+    unsigned flatten(FlatAST &Pool) const override;
+    BaseAST *simplify() override;
+    bool isPure() const override { return Cond->isPure() && Then->isPure() && Else->isPure(); }
+};
+
+llvm::Value *ExprIfAST::codegen()
+{
+    return emit_if(Cond, Then, Else, Ty, [](BaseAST *N) { return N->codegen(); });
+}
+
+unsigned ExprIfAST::flatten(FlatAST &Pool) const
+{
+    unsigned Ops[3] = {Cond->flatten(Pool), Then->flatten(Pool), Else->flatten(Pool)};
+    return Pool.add(FlatAST::FLAT_IF, Ty, 0, 0, Ops, 3);
+}
+
+// 条件是常量时只保留会执行的分支（分支类型与整个 if 不同时需要转换，保留）
+BaseAST *ExprIfAST::simplify()
+{
+    Cond = Cond->simplify();
+    Then = Then->simplify();
+    Else = Else->simplify();
+    if (NumericAST *C = dynamic_cast<NumericAST *>(Cond))
+    {
+        BaseAST *Taken = C->isTrue() ? Then : Else;
+        BaseAST *Dropped = C->isTrue() ? Else : Then;
+        // 丢弃的分支里若有未解析的名字，保留它让代码生成报错
+        if (Taken->getType() == Ty && Dropped->isPure())
+            return Taken;
+    }
+    return this;
+}
+
+class ExprForAST : public BaseAST
+{
+    unsigned Var_Id;
+    BaseAST *Start, *Step, *End, *Body;
+
+public:
+    ExprForAST(unsigned var_id,
+               BaseAST *start,
+               BaseAST *step,
+               BaseAST *end,
+               BaseAST *body) : BaseAST(TYPE_INT), Var_Id(var_id), Start(start), Step(step), End(end), Body(body) {}
+    llvm::Value *codegen() override;
+    unsigned flatten(FlatAST &Pool) const override;
+    BaseAST *simplify() override;
+};
+
+llvm::Value *ExprForAST::codegen()
+{
+    return emit_for(Var_Id, Start, Step, Step != nullptr, End, Body, [](BaseAST *N) { return N->codegen(); });
+}
+
+unsigned ExprForAST::flatten(FlatAST &Pool) const
+{
+    unsigned Ops[4] = {Start->flatten(Pool), End->flatten(Pool), Body->flatten(Pool), 0};
+    if (Step)
+        Ops[3] = Step->flatten(Pool);
+    return Pool.add(FlatAST::FLAT_FOR, Ty, 0, Var_Id, Ops, Step ? 4 : 3);
+}
+
+// for 的值恒为 0。结束条件恒不成立时循环体只执行一次，各部分都没有副作用就整个删除；
+// 其他没有副作用的循环可能不结束，保留
+BaseAST *ExprForAST::simplify()
+{
+    Start = Start->simplify();
+    End = End->simplify();
+    Body = Body->simplify();
+    if (Step)
+        Step = Step->simplify();
+
+    NumericAST *C = dynamic_cast<NumericAST *>(End);
+    if (C && !C->isTrue() && Start->isPure() && Body->isPure() && (!Step || Step->isPure()))
+        return AST_Arena.create<NumericAST>(0);
+    return this;
+}
+
+class ExprUnaryAST : public BaseAST
+{
+    char Opcode;
+    BaseAST *Operand;
+
+public:
+    ExprUnaryAST(char op, BaseAST *operand, ValueType ty) : BaseAST(ty), Opcode(op), Operand(operand) {}
+    virtual llvm::Value *codegen() { return codegen_tree(this); }
+    unsigned flatten(FlatAST &Pool) const override { return flatten_tree(this, Pool); }
+    BaseAST *simplify() override { return simplify_tree(this); }
+
+    unsigned getOperands(BaseAST **Ops) const override
+    {
+        Ops[0] = Operand;
+        return 1;
+    }
+    llvm::Value *emitNode(llvm::Value **Vals) override { return emit_unary(Opcode, Vals[0]); }
+    BaseAST *simplifyNode(BaseAST **Ops) override
+    {
+        Operand = Ops[0];
+        return this;
+    }
+    unsigned flattenNode(FlatAST &Pool, const unsigned *Ops) const override
+    {
+        return Pool.add(FlatAST::FLAT_UNARY, Ty, Opcode, 0, Ops, 1);
+    }
+};
+
+class ExprVarAST : public BaseAST
+{
+    std::vector<unsigned> Var_Ids;
+    std::vector<ValueType> Var_Types;
+    std::vector<BaseAST *> Inits; // 没有初值时为 nullptr
+    BaseAST *Body;
+
+public:
+    ExprVarAST(std::vector<unsigned> &var_ids, std::vector<ValueType> &var_types, std::vector<BaseAST *> &inits,
+               BaseAST *body)
+        : BaseAST(body->getType()), Var_Ids(var_ids), Var_Types(var_types), Inits(inits), Body(body) {}
+    llvm::Value *codegen() override;
+    unsigned flatten(FlatAST &Pool) const override;
+    BaseAST *simplify() override;
+};
+
+llvm::Value *ExprVarAST::codegen()
+{
+    return emit_var(Var_Ids.data(), Var_Types.data(), Inits.data(), Var_Ids.size(), (BaseAST *)nullptr, Body,
+                    [](BaseAST *N) { return N->codegen(); });
+}
+
+unsigned ExprVarAST::flatten(FlatAST &Pool) const
+{
+    std::vector<unsigned> Ops;
+    for (unsigned i = 0, e = Inits.size(); i != e; ++i)
+        Ops.push_back(Inits[i] ? Inits[i]->flatten(Pool) : FlatAST::NO_INIT);
+    Ops.push_back(Body->flatten(Pool));
+    Ops.insert(Ops.end(), Var_Ids.begin(), Var_Ids.end());
+    return Pool.add(FlatAST::FLAT_VAR, Ty, 0, Pool.addTypes(Var_Types), Ops.data(), Ops.size());
+}
+
+BaseAST *ExprVarAST::simplify()
+{
+    for (unsigned i = 0, e = Inits.size(); i != e; ++i)
+        if (Inits[i])
+            Inits[i] = Inits[i]->simplify();
+    Body = Body->simplify();
+    return this;
+}
+
+class ExprAssignAST : public BaseAST
+{
+    unsigned Var_Id;
+    BaseAST *Value;
+
+public:
+    ExprAssignAST(unsigned var_id, BaseAST *value, ValueType ty) : BaseAST(ty), Var_Id(var_id), Value(value) {}
+    llvm::Value *codegen() override { return codegen_tree(this); }
+    unsigned flatten(FlatAST &Pool) const override { return flatten_tree(this, Pool); }
+    BaseAST *simplify() override { return simplify_tree(this); }
+
+    unsigned getOperands(BaseAST **Ops) const override
+    {
+        Ops[0] = Value;
+        return 1;
+    }
+    llvm::Value *emitNode(llvm::Value **Vals) override { return emit_assign(Var_Id, Ty, Vals[0]); }
+    BaseAST *simplifyNode(BaseAST **Ops) override
+    {
+        Value = Ops[0];
+        return this;
+    }
+    unsigned flattenNode(FlatAST &Pool, const unsigned *Ops) const override
+    {
+        return Pool.add(FlatAST::FLAT_ASSIGN, Ty, 0, Var_Id, Ops, 1);
+    }
+};
+
+// int(x)、double(x)、vec4(x)、vec4(a, b, c, d)
+class ExprConstructAST : public BaseAST
+{
+    std::vector<BaseAST *> Args;
+
+public:
+    ExprConstructAST(ValueType ty, std::vector<BaseAST *> &args) : BaseAST(ty), Args(args) {}
+    llvm::Value *codegen() override;
+    unsigned flatten(FlatAST &Pool) const override;
+    BaseAST *simplify() override;
+    bool isPure() const override
+    {
+        for (unsigned i = 0, e = Args.size(); i != e; ++i)
+            if (!Args[i]->isPure())
+                return false;
+        return true;
+    }
+};
+
+llvm::Value *ExprConstructAST::codegen()
+{
+    return emit_construct(Ty, Args.data(), Args.size(), [](BaseAST *N) { return N->codegen(); });
+}
+
+unsigned ExprConstructAST::flatten(FlatAST &Pool) const
+{
+    std::vector<unsigned> Ops;
+    for (unsigned i = 0, e = Args.size(); i != e; ++i)
+        Ops.push_back(Args[i]->flatten(Pool));
+    return Pool.add(FlatAST::FLAT_CONSTRUCT, Ty, 0, 0, Ops.data(), Ops.size());
 }
 
-class ExprUnaryAST : public BaseAST
+BaseAST *ExprConstructAST::simplify()
 {
-    char Opcode;
-    BaseAST *Operand;
+    for (unsigned i = 0, e = Args.size(); i != e; ++i)
+        Args[i] = Args[i]->simplify();
+    // 类型相同的转换什么都不做
+    if (Args.size() == 1 && Args[0]->getType() == Ty)
+        return Args[0];
+    return this;
+}
+
+// v[i]：取 vec4 的一个分量；a[i]：读缓冲区的一个元素
+class ExprIndexAST : public BaseAST
+{
+    BaseAST *Vec, *Index;
 
 public:
-    ExprUnaryAST(char op, BaseAST *operand) : Opcode(op), Operand(operand) {}
-    virtual llvm::Value *codegen();
+    ExprIndexAST(BaseAST *vec, BaseAST *index)
+        : BaseAST(vec->getType() == TYPE_INT_BUFFER ? TYPE_INT : TYPE_DOUBLE), Vec(vec), Index(index) {}
+    BaseAST *getBase() const { return Vec; }
+    BaseAST *getIndex() const { return Index; }
+    llvm::Value *codegen() override;
+    unsigned flatten(FlatAST &Pool) const override;
+    BaseAST *simplify() override
+    {
+        Vec = Vec->simplify();
+        Index = Index->simplify();
+        return this;
+    }
+    bool isPure() const override { return Vec->isPure() && Index->isPure(); }
 };
 
-llvm::Value *ExprUnaryAST::codegen()
+llvm::Value *ExprIndexAST::codegen()
 {
-    llvm::Value *OperandV = Operand->codegen();
-    if (OperandV == 0)
-        return 0;
+    llvm::Value *V = Vec->codegen();
+    return emit_index(V, Index->codegen());
+}
 
-    llvm::Function *F = Module_ob->getFunction(std::string("unary") + Opcode);
-    if (F == nullptr)
-        return nullptr;
+unsigned ExprIndexAST::flatten(FlatAST &Pool) const
+{
+    unsigned Ops[2] = {Vec->flatten(Pool), Index->flatten(Pool)};
+    return Pool.add(FlatAST::FLAT_INDEX, Ty, 0, 0, Ops, 2);
+}
+
+// a[i] = x：写缓冲区的一个元素
+class ExprStoreAST : public BaseAST
+{
+    BaseAST *Buffer, *Index, *Value;
+
+public:
+    ExprStoreAST(BaseAST *buffer, BaseAST *index, BaseAST *value)
+        : BaseAST(buffer->getType() == TYPE_INT_BUFFER ? TYPE_INT : TYPE_DOUBLE), Buffer(buffer), Index(index), Value(value) {}
+    llvm::Value *codegen() override;
+    unsigned flatten(FlatAST &Pool) const override;
+    BaseAST *simplify() override
+    {
+        Buffer = Buffer->simplify();
+        Index = Index->simplify();
+        Value = Value->simplify();
+        return this;
+    }
+};
+
+llvm::Value *ExprStoreAST::codegen()
+{
+    llvm::Value *B = Buffer->codegen();
+    llvm::Value *I = Index->codegen();
+    return emit_store(B, I, Value->codegen());
+}
 
-    return Builder.CreateCall(F, OperandV, "tmp");
+unsigned ExprStoreAST::flatten(FlatAST &Pool) const
+{
+    unsigned Ops[3] = {Buffer->flatten(Pool), Index->flatten(Pool), Value->flatten(Pool)};
+    return Pool.add(FlatAST::FLAT_STORE, Ty, 0, 0, Ops, 3);
 }
 
 static int Current_Token;
 
+// 当前顶层项调用到的函数和运算符函数的名字，用于计算编译缓存的键
+static std::vector<std::string> Current_Deps;
+
+// 长运算符链反复用到同一个运算符，相邻的重复项只记一次
+static void add_dep(const std::string &Name)
+{
+    if (Current_Deps.empty() || Current_Deps.back() != Name)
+        Current_Deps.push_back(Name);
+}
+
 static int next_token()
 {
     Current_Token = get_token();
@@ -466,18 +2130,45 @@ static int next_token()
 
 static BaseAST *numeric_parser();
 static BaseAST *identifier_parser();
-static BaseAST *paran_parser();
 static BaseAST *expression_parser();
-static BaseAST *binary_op_parser(int Precedence, BaseAST *LHS);
 static BaseAST *If_parser();
 static BaseAST *For_parser();
-static BaseAST *unary_parser();
+static BaseAST *Var_parser();
+static BaseAST *construct_parser();
+
+// 正在解析的 def 的原型，函数体中的自递归调用据此确定返回类型
+static FunctionDeclAST *Current_Proto;
+
+// 调用的类型是被调用函数的返回类型；还不认识的函数按 int 处理，由代码生成报错
+static ValueType get_return_type(const std::string &Name)
+{
+    if (Current_Proto && Current_Proto->getName() == Name)
+        return Current_Proto->getReturnType();
+    std::map<std::string, std::unique_ptr<FunctionDeclAST>>::iterator It = Function_Protos.find(Name);
+    if (It != Function_Protos.end())
+        return It->second->getReturnType();
+    return TYPE_INT;
+}
+
+// 类型名，后面跟 [] 时是该元素类型的缓冲区；出错时返回 TYPE_NONE
+static ValueType type_parser()
+{
+    ValueType Ty = Type_Val;
+    next_token(); // eat type
+    if (Current_Token != '[')
+        return Ty;
+    if (next_token() != ']' || Ty == TYPE_VEC4)
+        return TYPE_NONE; // error: only int[] and double[] buffers
+    next_token(); // eat ']'
+    return Ty == TYPE_INT ? TYPE_INT_BUFFER : TYPE_DOUBLE_BUFFER;
+}
 
 static BaseAST *Base_Parser()
 {
     switch (Current_Token)
     {
     case NUMERIC_TOKEN:
+    case FP_NUMERIC_TOKEN:
     {
         return numeric_parser();
     }
@@ -485,10 +2176,6 @@ static BaseAST *Base_Parser()
     {
         return identifier_parser();
     }
-    case '(':
-    {
-        return paran_parser();
-    }
     case IF_TOKEN:
     {
         return If_parser();
@@ -497,34 +2184,63 @@ static BaseAST *Base_Parser()
     {
         return For_parser();
     }
+    case VAR_TOKEN:
+    {
+        return Var_parser();
+    }
+    case TYPE_TOKEN:
+    {
+        return construct_parser();
+    }
     default:
         return 0;
     }
 }
 
-static BaseAST *numeric_parser()
+// 基本表达式或括号表达式之后的 [i] 取 vec4 的分量或缓冲区的元素
+static BaseAST *index_parser(BaseAST *E)
 {
-    BaseAST *Result = new NumericAST(Numeric_Val);
-    next_token();
-    return Result;
+    while (E && Current_Token == '[')
+    {
+        next_token(); // eat '['
+        BaseAST *Index = expression_parser();
+        if (!Index || Current_Token != ']')
+            return 0;
+        next_token(); // eat ']'
+        ValueType Ty = E->getType();
+        if ((Ty != TYPE_VEC4 && !is_buffer_type(Ty)) || !can_convert(Index->getType(), TYPE_INT))
+            return 0; // error: only vec4 values and buffers can be indexed
+        E = AST_Arena.create<ExprIndexAST>(E, Index);
+    }
+    return E;
 }
 
-static BaseAST *expression_parser()
+static BaseAST *numeric_parser()
 {
-    BaseAST *LHS = unary_parser();
-    if (!LHS)
-        return 0;
-    return binary_op_parser(0, LHS);
+    BaseAST *Result;
+    if (Current_Token == NUMERIC_TOKEN && Numeric_Out_Of_Range)
+        return 0; // error: integer literal out of range
+    if (Current_Token == FP_NUMERIC_TOKEN)
+        Result = AST_Arena.create<NumericAST>(FP_Numeric_Val);
+    else
+        Result = AST_Arena.create<NumericAST>(Numeric_Val);
+    next_token();
+    return Result;
 }
 
 static BaseAST *identifier_parser()
 {
-    std::string IdName = Identifier_string;
+    std::string IdName = Identifier_string.str();
 
     next_token();
 
     if (Current_Token != '(')
-        return new VariableAST(IdName);
+    {
+        // 未声明的变量按 int 处理，由代码生成报错
+        unsigned Id = Identifiers.intern(IdName);
+        ValueType Ty = Var_Types.lookup(Id);
+        return AST_Arena.create<VariableAST>(Id, Ty == TYPE_NONE ? TYPE_INT : Ty, Ty != TYPE_NONE);
+    }
 
     next_token(); // eat '('
 
@@ -550,7 +2266,8 @@ static BaseAST *identifier_parser()
 
     next_token(); // eat ')'
 
-    return new FunctionCallAST(IdName, Args);
+    add_dep(IdName);
+    return AST_Arena.create<FunctionCallAST>(IdName, Args, get_return_type(IdName));
 }
 
 static FunctionDeclAST *func_decl_parser()
@@ -560,10 +2277,18 @@ static FunctionDeclAST *func_decl_parser()
     unsigned Kind = 0;
     unsigned BinaryPrecedence = 30;
 
+    // def double f(...)：可选的返回类型，默认 int
+    ValueType Return_Type = TYPE_INT;
+    if (Current_Token == TYPE_TOKEN)
+    {
+        Return_Type = Type_Val;
+        next_token();
+    }
+
     switch (Current_Token)
     {
     case IDENTIFIER_TOKEN:
-        FnName = Identifier_string;
+        FnName = Identifier_string.str();
         Kind = 0;
         next_token();
         break;
@@ -580,8 +2305,8 @@ static FunctionDeclAST *func_decl_parser()
 
     case BINARY_TOKEN:
         next_token(); // eat binary operator
-        if (!isascii(Current_Token))
-            return 0;
+        if (!isascii(Current_Token) || Current_Token == '=')
+            return 0; // '=' 留给赋值
         FnName = "binary";
         FnName += (char)Current_Token;
         Kind = 2;
@@ -603,9 +2328,23 @@ static FunctionDeclAST *func_decl_parser()
     if (Current_Token != '(')
         return 0; // error: expected '('
 
+    // 参数前可以写类型：(double x vec4 v double[] buf n)，默认 int
     std::vector<std::string> Function_Argument_Names;
-    while (next_token() == IDENTIFIER_TOKEN)
-        Function_Argument_Names.push_back(Identifier_string);
+    std::vector<ValueType> Function_Argument_Types;
+    next_token(); // eat '('
+    while (Current_Token == IDENTIFIER_TOKEN || Current_Token == TYPE_TOKEN)
+    {
+        ValueType Ty = TYPE_INT;
+        if (Current_Token == TYPE_TOKEN)
+        {
+            Ty = type_parser();
+            if (Ty == TYPE_NONE || Current_Token != IDENTIFIER_TOKEN)
+                return 0;
+        }
+        Function_Argument_Names.push_back(Identifier_string.str());
+        Function_Argument_Types.push_back(Ty);
+        next_token();
+    }
 
     if (Current_Token != ')')
         return 0; // error: expected ')'
@@ -615,7 +2354,8 @@ static FunctionDeclAST *func_decl_parser()
     if (Kind && Function_Argument_Names.size() != Kind)
         return 0;
 
-    return new FunctionDeclAST(FnName, Function_Argument_Names, Kind != 0, BinaryPrecedence);
+    return AST_Arena.create<FunctionDeclAST>(FnName, Function_Argument_Names, Function_Argument_Types, Return_Type,
+                                             Kind != 0, BinaryPrecedence);
 }
 
 static FunctionDefnAST *func_defn_parser()
@@ -627,8 +2367,27 @@ static FunctionDefnAST *func_defn_parser()
     if (Func_Decl == 0)
         return 0;
 
-    if (BaseAST *Body = expression_parser())
-        return new FunctionDefnAST(Func_Decl, Body);
+    // 参数的类型在函数体中可见
+    BaseAST *Body;
+    size_t Body_Start;
+    {
+        SymbolTable<ValueType>::Scope Params(Var_Types);
+        for (unsigned i = 0, e = Func_Decl->getArgumentIds().size(); i != e; ++i)
+            Var_Types.bind(Func_Decl->getArgumentIds()[i], Func_Decl->getArgumentTypes()[i]);
+        Current_Proto = Func_Decl;
+        Body_Start = AST_Arena.getNumNodes();
+        Body = expression_parser();
+        Current_Proto = nullptr;
+    }
+
+    if (Body)
+    {
+        size_t Body_Nodes = AST_Arena.getNumNodes() - Body_Start;
+        FunctionDefnAST *Defn = AST_Arena.create<FunctionDefnAST>(Func_Decl, Body);
+        Defn->registerOperator();
+        Defn->simplify(Body_Nodes);
+        return Defn;
+    }
 
     return 0;
 }
@@ -657,7 +2416,12 @@ static BaseAST *If_parser()
     if (!Else)
         return 0;
 
-    return new ExprIfAST(Cond, Then, Else);
+    if (!can_convert(Cond->getType(), TYPE_INT))
+        return 0; // error: condition must be a scalar
+    ValueType Ty = std::max(Then->getType(), Else->getType());
+    if (!can_convert(Then->getType(), Ty) || !can_convert(Else->getType(), Ty))
+        return 0; // error: mismatched branch types
+    return AST_Arena.create<ExprIfAST>(Cond, Then, Else, Ty);
 }
 
 static BaseAST *For_parser()
@@ -667,148 +2431,922 @@ static BaseAST *For_parser()
     if (Current_Token != IDENTIFIER_TOKEN)
         return 0;
 
-    std::string IdName = Identifier_string;
+    std::string IdName = Identifier_string.str();
 
     next_token(); // eat '='
 
     if (Current_Token != '=')
         return 0;
 
-    next_token();
+    next_token();
+
+    BaseAST *Start = expression_parser();
+    if (Start == 0)
+        return 0;
+    if (Current_Token != ',')
+        return 0;
+
+    next_token();
+
+    // 循环变量总是 int，在结束条件、步进和循环体中可见
+    unsigned Var_Id = Identifiers.intern(IdName);
+    SymbolTable<ValueType>::Scope Loop_Scope(Var_Types);
+    Var_Types.bind(Var_Id, TYPE_INT);
+
+    BaseAST *End = expression_parser();
+    if (End == 0)
+        return 0;
+
+    BaseAST *Step = nullptr;
+    if (Current_Token == ',')
+    {
+        next_token();
+        Step = expression_parser();
+        if (Step == 0)
+            return 0;
+    }
+
+    if (Current_Token != IN_TOKEN)
+        return 0; // error: expected 'in'
+
+    next_token();
+
+    BaseAST *Body = expression_parser();
+    if (Body == 0)
+        return 0;
+
+    if (!can_convert(Start->getType(), TYPE_INT) || !can_convert(End->getType(), TYPE_INT) ||
+        (Step && !can_convert(Step->getType(), TYPE_INT)))
+        return 0; // error: loop bounds must be scalars
+    return AST_Arena.create<ExprForAST>(Var_Id, Start, Step, End, Body);
+}
+
+static BaseAST *Var_parser()
+{
+    next_token(); // eat 'var'
+
+    std::vector<unsigned> Var_Ids;
+    std::vector<ValueType> Types;
+    std::vector<BaseAST *> Inits;
+    SymbolTable<ValueType>::Scope Var_Scope(Var_Types);
+    while (1)
+    {
+        // 没写类型时取初值的类型，没有初值时为 int
+        ValueType Ty = TYPE_NONE;
+        if (Current_Token == TYPE_TOKEN && (Ty = type_parser()) == TYPE_NONE)
+            return 0;
+        if (Current_Token != IDENTIFIER_TOKEN)
+            return 0; // error: expected identifier after 'var'
+        Var_Ids.push_back(Identifiers.intern(Identifier_string));
+        next_token();
+
+        BaseAST *Init = nullptr;
+        if (Current_Token == '=')
+        {
+            next_token(); // eat '='
+            Init = expression_parser();
+            if (Init == 0)
+                return 0;
+            if (Ty == TYPE_NONE)
+                Ty = Init->getType();
+            else if (!can_convert(Init->getType(), Ty))
+                return 0; // error: mismatched initializer type
+        }
+        if (Ty == TYPE_NONE)
+            Ty = TYPE_INT;
+        else if (is_buffer_type(Ty) && !Init)
+            return 0; // error: buffer variables need an initializer
+        Inits.push_back(Init);
+        Types.push_back(Ty);
+        // 初值求完后才绑定，初值中的同名变量仍指向外层
+        Var_Types.bind(Var_Ids.back(), Ty);
+
+        if (Current_Token != ',')
+            break;
+        next_token(); // eat ','
+    }
+
+    if (Current_Token != IN_TOKEN)
+        return 0; // error: expected 'in'
+    next_token();
+
+    BaseAST *Body = expression_parser();
+    if (Body == 0)
+        return 0;
+
+    return AST_Arena.create<ExprVarAST>(Var_Ids, Types, Inits, Body);
+}
+
+static void init_precedence()
+{
+    std::fill(std::begin(Operator_Precedence), std::end(Operator_Precedence), -1);
+    // 赋值优先级最低，并在 expression_parser 中按右结合处理
+    Operator_Precedence['='] = 0;
+    Operator_Precedence['<'] = 0;
+    Operator_Precedence['-'] = 1;
+    Operator_Precedence['+'] = 2;
+    Operator_Precedence['/'] = 3;
+    Operator_Precedence['*'] = 4;
+}
+
+static int getBinOpPrecedence()
+{
+    if (Current_Token < 0 || Current_Token > 255)
+        return -1;
+
+    return Operator_Precedence[Current_Token];
+}
+
+static BaseAST *make_unary(char Op, BaseAST *Operand)
+{
+    std::string Name = std::string("unary") + Op;
+    add_dep(Name);
+    return AST_Arena.create<ExprUnaryAST>(Op, Operand, get_return_type(Name));
+}
+
+static BaseAST *make_binary(char BinOp, BaseAST *LHS, BaseAST *RHS)
+{
+    // 内置运算符的类型是两侧较宽的类型，标量比较得到 int；自定义运算符取函数的返回类型。
+    // 内置运算符不会被重新定义，不记入缓存键的依赖
+    ValueType Ty;
+    if (is_builtin_operator(BinOp))
+    {
+        if (!is_arith_type(LHS->getType()) || !is_arith_type(RHS->getType()))
+            return 0; // error: buffers only support indexing
+        Ty = std::max(LHS->getType(), RHS->getType());
+        if (BinOp == '<' && Ty != TYPE_VEC4)
+            Ty = TYPE_INT;
+    }
+    else
+    {
+        std::string Name = std::string("binary") + BinOp;
+        add_dep(Name);
+        Ty = get_return_type(Name);
+    }
+    return AST_Arena.create<BinaryAST>(BinOp, LHS, RHS, Ty);
+}
+
+// 左侧必须是变量或缓冲区元素 a[i]
+static BaseAST *make_assign(BaseAST *LHS, BaseAST *Val)
+{
+    VariableAST *Dest = dynamic_cast<VariableAST *>(LHS);
+    ExprIndexAST *Elt = dynamic_cast<ExprIndexAST *>(LHS);
+    if (Elt && !is_buffer_type(Elt->getBase()->getType()))
+        Elt = nullptr;
+    if (!Dest && !Elt)
+        return 0; // error: destination of '=' must be a variable or a buffer element
+    if (!can_convert(Val->getType(), LHS->getType()))
+        return 0; // error: mismatched assignment type
+    AST_Arena.discard();
+    if (Elt)
+        return AST_Arena.create<ExprStoreAST>(Elt->getBase(), Elt->getIndex(), Val);
+    return AST_Arena.create<ExprAssignAST>(Dest->getId(), Val, Dest->getType());
+}
+
+// 运算符优先级解析（调度场算法）：操作数和未归约的运算符放在显式栈上，
+// 百万项的运算符链、括号嵌套或一元运算符链都不会加深本机栈。
+// 一元运算符作用于紧随其后的操作数（含 [i]），二元运算符同优先级左结合，
+// '=' 优先级最低且右结合：右侧整个表达式都是被赋的值。
+static BaseAST *expression_parser()
+{
+    enum Pending_Kind
+    {
+        PENDING_UNARY,
+        PENDING_BINARY,
+        PENDING_PAREN
+    };
+    struct Pending
+    {
+        Pending_Kind Kind;
+        char Op;
+        int Prec;
+    };
+    llvm::SmallVector<Pending, 16> Ops;
+    llvm::SmallVector<BaseAST *, 16> Operands;
+
+    // 用栈顶的二元运算符归约栈顶的两个操作数
+    auto reduce_binary = [&]() -> bool
+    {
+        BaseAST *RHS = Operands.pop_back_val();
+        char BinOp = Ops.pop_back_val().Op;
+        BaseAST *&LHS = Operands.back();
+        LHS = BinOp == '=' ? make_assign(LHS, RHS) : make_binary(BinOp, LHS, RHS);
+        return LHS != 0;
+    };
+    auto reduce_unary = [&]()
+    {
+        while (!Ops.empty() && Ops.back().Kind == PENDING_UNARY)
+            Operands.back() = make_unary(Ops.pop_back_val().Op, Operands.back());
+    };
+
+    while (1)
+    {
+        // 操作数：先收下前缀的 '(' 和一元运算符
+        // 记号的枚举值也落在 ASCII 范围内，只有标点字符才可能是一元运算符
+        while (ispunct(Current_Token) && Current_Token != ',')
+        {
+            Ops.push_back({Current_Token == '(' ? PENDING_PAREN : PENDING_UNARY, (char)Current_Token, 0});
+            next_token();
+        }
+        BaseAST *E = index_parser(Base_Parser());
+        if (!E)
+            return 0;
+        Operands.push_back(E);
+        reduce_unary();
+
+        // 右括号：归约到对应的 '('，没有未闭合的 '(' 时它属于外层（如函数调用）
+        while (Current_Token == ')')
+        {
+            while (!Ops.empty() && Ops.back().Kind == PENDING_BINARY)
+                if (!reduce_binary())
+                    return 0;
+            if (Ops.empty())
+                return Operands.back();
+            Ops.pop_back();
+            next_token(); // eat ')'
+            if (!(Operands.back() = index_parser(Operands.back())))
+                return 0;
+            reduce_unary();
+        }
+
+        int Operator_Prec = getBinOpPrecedence();
+        if (Operator_Prec < 0)
+            break;
+        char BinOp = Current_Token;
+        next_token();
+
+        // 已入栈的 '=' 等它的右侧结束再归约；新的 '=' 之前的左侧必须先归约完整
+        while (!Ops.empty() && Ops.back().Kind == PENDING_BINARY && Ops.back().Op != '=' &&
+               (BinOp == '=' || Ops.back().Prec >= Operator_Prec))
+            if (!reduce_binary())
+                return 0;
+        Ops.push_back({PENDING_BINARY, BinOp, Operator_Prec});
+    }
+
+    while (!Ops.empty())
+        if (Ops.back().Kind != PENDING_BINARY || !reduce_binary())
+            return 0; // error: expected ')'
+    return Operands.back();
+}
+
+// int(x)、double(x)、vec4(x) 或 vec4(a, b, c, d)
+static BaseAST *construct_parser()
+{
+    ValueType Ty = Type_Val;
+    next_token(); // eat type
+    if (Current_Token != '(')
+        return 0; // error: expected '(' after type
+    next_token(); // eat '('
+
+    std::vector<BaseAST *> Args;
+    while (1)
+    {
+        BaseAST *Arg = expression_parser();
+        if (!Arg)
+            return 0;
+        Args.push_back(Arg);
+        if (Current_Token == ')')
+            break;
+        if (Current_Token != ',')
+            return 0; // error: expected ','
+        next_token(); // eat ','
+    }
+    next_token(); // eat ')'
+
+    if (Args.size() != 1 && !(Ty == TYPE_VEC4 && Args.size() == 4))
+        return 0; // error: wrong number of components
+    for (BaseAST *Arg : Args)
+        if (!is_arith_type(Arg->getType()) || (Arg->getType() == TYPE_VEC4 && (Ty != TYPE_VEC4 || Args.size() != 1)))
+            return 0; // error: vec4 cannot be converted to a scalar
+    return AST_Arena.create<ExprConstructAST>(Ty, Args);
+}
+
+// 需要 TargetMachine 的情况：生成 bc/asm/obj、JIT，以及指定了 -mcpu/-mattr 或 -O3 时的 --emit=ll，
+// 后者让 IR 带上目标的数据布局，优化流水线（如循环向量化）按目标的代价模型进行
+static bool needs_target_machine()
+{
+    return Emit != EMIT_LL || UseJIT || MCPU.getNumOccurrences() || !MAttrs.empty() || OptLevel == '3';
+}
+
+static llvm::CodeGenOpt::Level codegen_opt_level()
+{
+    if (OptLevel == '1')
+        return llvm::CodeGenOpt::Less;
+    if (OptLevel == '2')
+        return llvm::CodeGenOpt::Default;
+    if (OptLevel == '3')
+        return llvm::CodeGenOpt::Aggressive;
+    return llvm::CodeGenOpt::None;
+}
+
+// 检查 -mcpu 对宿主三元组是否有效（native 总是有效）
+static bool is_valid_cpu(const llvm::Target *T, const std::string &Triple, const std::string &CPU)
+{
+    if (CPU == "native")
+        return true;
+    std::unique_ptr<llvm::MCSubtargetInfo> STI(T->createMCSubtargetInfo(Triple, "", ""));
+    if (STI->isCPUStringValid(CPU))
+        return true;
+    llvm::errs() << "unknown CPU '" << CPU << "' for " << Triple << "\n";
+    return false;
+}
+
+// JIT 的代码在本机执行，默认按宿主 CPU 及其特性生成（循环向量化等需要知道向量寄存器宽度）；
+// 显式给出的 -mcpu/-mattr 和 -O 对应的后端优化级别同样作用于 JIT 编译出的代码
+static llvm::Optional<llvm::orc::JITTargetMachineBuilder> jit_target_machine_builder()
+{
+    llvm::Expected<llvm::orc::JITTargetMachineBuilder> JTMB = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if (!JTMB)
+    {
+        llvm::errs() << llvm::toString(JTMB.takeError()) << "\n";
+        return llvm::None;
+    }
+    if (MCPU.getNumOccurrences() && MCPU != "native")
+    {
+        std::string Triple = JTMB->getTargetTriple().str();
+        std::string Error;
+        const llvm::Target *T = llvm::TargetRegistry::lookupTarget(Triple, Error);
+        if (!T)
+        {
+            llvm::errs() << Error << "\n";
+            return llvm::None;
+        }
+        if (!is_valid_cpu(T, Triple, MCPU))
+            return llvm::None;
+        // 指定了别的 CPU 时不再带宿主的特性，与 --emit 时的行为一致
+        JTMB->setCPU(MCPU);
+        JTMB->getFeatures() = llvm::SubtargetFeatures();
+    }
+    if (!MAttrs.empty())
+        JTMB->getFeatures().AddFeature(MAttrs);
+    JTMB->setCodeGenOptLevel(codegen_opt_level());
+    return std::move(*JTMB);
+}
+
+// 为宿主三元组按 -mcpu/-mattr 创建 TargetMachine，-mcpu=native 时取宿主 CPU 及其特性
+static llvm::TargetMachine *create_target_machine()
+{
+    // JIT 模式下用与 LLJIT 相同的配置，IR 级优化按 JIT 实际生成代码的目标进行
+    if (UseJIT)
+    {
+        llvm::Optional<llvm::orc::JITTargetMachineBuilder> JTMB = jit_target_machine_builder();
+        if (!JTMB)
+            return nullptr;
+        llvm::Expected<std::unique_ptr<llvm::TargetMachine>> TM = JTMB->createTargetMachine();
+        if (!TM)
+        {
+            llvm::errs() << llvm::toString(TM.takeError()) << "\n";
+            return nullptr;
+        }
+        return TM->release();
+    }
+
+    std::string Triple = llvm::sys::getDefaultTargetTriple();
+    std::string Error;
+    const llvm::Target *T = llvm::TargetRegistry::lookupTarget(Triple, Error);
+    if (!T)
+    {
+        llvm::errs() << Error << "\n";
+        return nullptr;
+    }
+
+    std::string CPU = MCPU;
+    llvm::SubtargetFeatures Features;
+    if (!is_valid_cpu(T, Triple, CPU))
+        return nullptr;
+    if (CPU == "native")
+    {
+        CPU = llvm::sys::getHostCPUName().str();
+        llvm::StringMap<bool> Host_Features;
+        if (llvm::sys::getHostCPUFeatures(Host_Features))
+            for (const llvm::StringMapEntry<bool> &F : Host_Features)
+                Features.AddFeature(F.first(), F.second);
+    }
+    if (!MAttrs.empty())
+        Features.AddFeature(MAttrs);
+
+    return T->createTargetMachine(Triple, CPU, Features.getString(), llvm::TargetOptions(), llvm::Reloc::PIC_,
+                                  llvm::None, codegen_opt_level());
+}
+
+// 按 -O 级别构建函数级优化流水线，-O0 时不创建 Global_FP
+static void InitializeOptimizer()
+{
+    if (OptLevel < '0' || OptLevel > '3')
+    {
+        llvm::errs() << "invalid optimization level -O" << OptLevel << "\n";
+        exit(1);
+    }
+    if (OptLevel == '0')
+        return;
+
+    Global_LAM = new llvm::LoopAnalysisManager();
+    Global_FAM = new llvm::FunctionAnalysisManager();
+    Global_CGAM = new llvm::CGSCCAnalysisManager();
+    Global_MAM = new llvm::ModuleAnalysisManager();
+
+    // 有 TargetMachine 时流水线用目标相关的代价模型
+    llvm::PassBuilder PB(Target_Machine);
+    PB.registerModuleAnalyses(*Global_MAM);
+    PB.registerCGSCCAnalyses(*Global_CGAM);
+    PB.registerFunctionAnalyses(*Global_FAM);
+    PB.registerLoopAnalyses(*Global_LAM);
+    PB.crossRegisterProxies(*Global_LAM, *Global_FAM, *Global_CGAM, *Global_MAM);
+
+    Global_FP = new llvm::FunctionPassManager();
+    // -O1：提升到寄存器并做窥孔合并
+    Global_FP->addPass(llvm::PromotePass());
+    Global_FP->addPass(llvm::InstCombinePass());
+    if (OptLevel >= '2')
+    {
+        // -O2：重结合表达式并消除公共子表达式
+        Global_FP->addPass(llvm::ReassociatePass());
+        Global_FP->addPass(llvm::GVNPass());
+    }
+    Global_FP->addPass(llvm::SimplifyCFGPass());
+    if (OptLevel >= '2')
+    {
+        // 自递归的尾调用改成循环，fib 这类两路递归也能消去其中一路
+        Global_FP->addPass(llvm::TailCallElimPass());
+    }
+    if (OptLevel >= '3')
+    {
+        // -O3：把 ExprForAST 循环中的不变量外提
+        Global_FP->addPass(llvm::createFunctionToLoopPassAdaptor(llvm::LICMPass(), /*UseMemorySSA=*/true));
+        // var 累加器提升到寄存器后成为归约循环，可以向量化和展开
+        Global_FP->addPass(llvm::LoopVectorizePass());
+        Global_FP->addPass(llvm::LoopUnrollPass(llvm::LoopUnrollOptions(3)));
+        Global_FP->addPass(llvm::InstCombinePass());
+    }
+}
+
+// 释放 InitializeOptimizer 创建的流水线和分析管理器，按创建的相反顺序
+static void ReleaseOptimizer()
+{
+    delete Global_FP;
+    delete Global_MAM;
+    delete Global_CGAM;
+    delete Global_FAM;
+    delete Global_LAM;
+    Global_FP = nullptr;
+    Global_MAM = nullptr;
+    Global_CGAM = nullptr;
+    Global_FAM = nullptr;
+    Global_LAM = nullptr;
+}
+
+static unsigned count_calls(llvm::Module &M)
+{
+    unsigned Num_Calls = 0;
+    for (llvm::Function &F : M)
+        for (llvm::BasicBlock &BB : F)
+            for (llvm::Instruction &I : BB)
+                if (llvm::isa<llvm::CallInst>(I))
+                    ++Num_Calls;
+    return Num_Calls;
+}
 
-    BaseAST *Start = expression_parser();
-    if (Start == 0)
-        return 0;
-    if (Current_Token != ',')
-        return 0;
+// 每个 def 单独优化时看不到被调用者的函数体，整个模块生成完后再统一内联：
+// 运算符函数只能从 toy 代码中调用，不是自递归的就改为 internal + alwaysinline，内联后整个删掉；
+// 普通 def 可能被外部的 C 代码调用，保持外部可见，由内联器按代价决定是否内联。
+// 内联让编译时间成倍增加，只在 -O3 做；JIT 模式下每个顶层项是单独的模块，不做这一步。
+static void OptimizeModule()
+{
+    if (OptLevel < '3' || !ModuleInline || TheJIT)
+        return;
 
-    next_token();
+    unsigned Calls_Before = count_calls(*Module_ob);
 
-    BaseAST *End = expression_parser();
-    if (End == 0)
-        return 0;
+    for (llvm::Function &F : *Module_ob)
+    {
+        if (F.isDeclaration())
+            continue;
+        // 按原型上的运算符标记判断，binarysearch 这样的普通 def 不能被删掉
+        std::map<std::string, std::unique_ptr<FunctionDeclAST>>::const_iterator It = Function_Protos.find(F.getName().str());
+        if (It == Function_Protos.end() || !(It->second->isUnaryOp() || It->second->isBinaryOp()))
+            continue;
+        bool Self_Recursive = false;
+        for (llvm::User *U : F.users())
+            if (llvm::CallInst *CI = llvm::dyn_cast<llvm::CallInst>(U))
+                Self_Recursive |= CI->getFunction() == &F;
+        if (Self_Recursive)
+            continue;
+        F.setLinkage(llvm::GlobalValue::InternalLinkage);
+        F.addFnAttr(llvm::Attribute::AlwaysInline);
+    }
 
-    BaseAST *Step = nullptr;
-    if (Current_Token == ',')
+    // 内联后在每个 SCC 上重新化简，并把新暴露出来的自递归尾调用改成循环
+    llvm::ModuleInlinerWrapperPass Inliner(llvm::getInlineParams(OptLevel - '0', 0));
+    llvm::FunctionPassManager FPM;
+    FPM.addPass(llvm::InstCombinePass());
+    FPM.addPass(llvm::SimplifyCFGPass());
+    FPM.addPass(llvm::TailCallElimPass());
+    Inliner.getPM().addPass(llvm::createCGSCCToFunctionPassAdaptor(std::move(FPM)));
+
+    llvm::ModulePassManager MPM;
+    MPM.addPass(std::move(Inliner));
+    MPM.addPass(llvm::GlobalDCEPass());
     {
-        next_token();
-        Step = expression_parser();
-        if (Step == 0)
-            return 0;
+        PhaseTimer Timer(PHASE_MODULE_OPTIMIZE);
+        MPM.run(*Module_ob, *Global_MAM);
     }
+    if (PhaseStats)
+        count_phase(PHASE_MODULE_OPTIMIZE, Module_ob->getInstructionCount());
 
-    if (Current_Token != IN_TOKEN)
-        return 0; // error: expected 'in'
+    if (ReportCalls)
+        llvm::errs() << "call sites: " << Calls_Before << " before module inlining, " << count_calls(*Module_ob)
+                     << " after\n";
+}
 
-    next_token();
+// -report-compile-time 的汇总，与 -phase-stats 读取同一组阶段计时（代码生成包括校验）
+static void ReportOptimizerTime()
+{
+    double Codegen_Ms = phase_ms(PHASE_CODEGEN) + phase_ms(PHASE_VERIFY);
+    llvm::errs() << "-O" << OptLevel << ": parse " << llvm::format("%.3f", phase_ms(PHASE_PARSE)) << " ms, codegen "
+                 << llvm::format("%.3f", Codegen_Ms) << " ms, optimization "
+                 << llvm::format("%.3f", phase_ms(PHASE_OPTIMIZE)) << " ms over " << Num_Optimized_Functions
+                 << " functions\n";
+
+    double MB = Input_Bytes / (1024.0 * 1024.0);
+    double Front_End_Secs = (phase_ms(PHASE_PARSE) + Codegen_Ms) / 1e3;
+    llvm::errs() << "parse+codegen throughput: " << llvm::format("%.2f", MB / Front_End_Secs) << " MB/s\n";
+
+    if (Threads)
+        llvm::errs() << "-j" << Threads << ": parallel codegen+optimization "
+                     << llvm::format("%.3f", std::chrono::duration<double, std::milli>(Parallel_Time).count())
+                     << " ms wall, link " << llvm::format("%.3f", phase_ms(PHASE_LINK)) << " ms\n";
+    if (Phases[PHASE_MODULE_OPTIMIZE].Runs)
+        llvm::errs() << "module inlining: " << llvm::format("%.3f", phase_ms(PHASE_MODULE_OPTIMIZE)) << " ms\n";
+}
 
-    BaseAST *Body = expression_parser();
-    if (Body == 0)
-        return 0;
+static void ReportMemoryUsage()
+{
+    struct rusage Usage;
+    getrusage(RUSAGE_SELF, &Usage);
+    // Linux 下 ru_maxrss 的单位是 KB
+    llvm::errs() << "peak RSS: " << Usage.ru_maxrss << " KB\n";
+    llvm::errs() << "AST arena: " << AST_Arena.getNumItems() << " top-level items, " << AST_Arena.getTotalBytes()
+                 << " bytes allocated, peak " << AST_Arena.getPeakBytes() << " bytes per item\n";
+}
 
-    return new ExprForAST(IdName, Start, Step, End, Body);
+// -phase-stats 时先单独把输入扫描一遍，得到纯词法分析的耗时和记号数；
+// 解析阶段边解析边取记号，它的时间仍包含词法分析
+static void measure_lexing()
+{
+    if (!PhaseStats)
+        return;
+    {
+        PhaseTimer Timer(PHASE_LEX);
+        uint64_t Tokens = 0;
+        while (get_token() != EOF_TOKEN)
+            ++Tokens;
+        count_phase(PHASE_LEX, Tokens);
+    }
+    reset_lexer();
 }
 
-static BaseAST *unary_parser()
+static void ReportPhaseStats(std::chrono::steady_clock::time_point Program_Start)
 {
-    if (isascii(Current_Token) || Current_Token == '(' || Current_Token == ',')
-        return Base_Parser();
+    std::unique_ptr<llvm::raw_fd_ostream> File;
+    if (!PhaseStatsFile.empty())
+    {
+        std::error_code EC;
+        File = std::make_unique<llvm::raw_fd_ostream>(PhaseStatsFile, EC, llvm::sys::fs::OF_Text);
+        if (EC)
+        {
+            llvm::errs() << "cannot open " << PhaseStatsFile << ": " << EC.message() << "\n";
+            return;
+        }
+    }
+    llvm::raw_ostream &OS = File ? *File : llvm::errs();
 
-    int Op = Current_Token;
+    struct rusage Usage;
+    getrusage(RUSAGE_SELF, &Usage);
+    double Wall_Ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Program_Start).count();
+    double CPU_Ms = (Usage.ru_utime.tv_sec + Usage.ru_stime.tv_sec) * 1e3 +
+                    (Usage.ru_utime.tv_usec + Usage.ru_stime.tv_usec) / 1e3;
 
-    next_token();
+    if (PhaseStatsFormat == STATS_JSON)
+    {
+        llvm::json::OStream J(OS, 2);
+        J.object([&] {
+            J.attribute("input_bytes", (int64_t)Input_Bytes);
+            J.attribute("opt_level", std::string(1, OptLevel));
+            J.attribute("threads", (int64_t)Threads);
+            J.attribute("wall_ms", Wall_Ms);
+            J.attribute("cpu_ms", CPU_Ms);
+            J.attribute("peak_rss_kb", (int64_t)Usage.ru_maxrss);
+            J.attribute("ast_arena_bytes", (int64_t)AST_Arena.getTotalBytes());
+            J.attributeObject("phases", [&] {
+                for (unsigned i = 0; i != NUM_PHASES; ++i)
+                    J.attributeObject(Phase_Names[i], [&] {
+                        J.attribute("wall_ms", Phases[i].Wall_Ns / 1e6);
+                        J.attribute("cpu_ms", Phases[i].CPU_Ns / 1e6);
+                        if (Count_Allocations)
+                            J.attribute("alloc_bytes", (int64_t)Phases[i].Alloc_Bytes);
+                        J.attribute("runs", (int64_t)Phases[i].Runs);
+                        J.attribute("count", (int64_t)Phases[i].Count);
+                        J.attribute("unit", Phase_Units[i]);
+                    });
+            });
+        });
+        OS << "\n";
+        return;
+    }
 
-    if (BaseAST *Operand = unary_parser())
-        return new ExprUnaryAST(Op, Operand);
+    OS << "===" << std::string(73, '-') << "===\n"
+       << "                       Toy compiler phase statistics\n"
+       << "===" << std::string(73, '-') << "===\n"
+       << llvm::format("  Total: %.3f ms wall, %.3f ms CPU, %zu input bytes, peak RSS %ld KB, AST arena %zu bytes\n\n",
+                       Wall_Ms, CPU_Ms, Input_Bytes, Usage.ru_maxrss, AST_Arena.getTotalBytes())
+       << "   Wall (ms)    CPU (ms)   Alloc (KB)       Runs        Count  Phase\n";
+    for (unsigned i = 0; i != NUM_PHASES; ++i)
+    {
+        const Phase_Stats &S = Phases[i];
+        if (S.Runs == 0)
+            continue;
+        OS << llvm::format("  %10.3f  %10.3f  ", S.Wall_Ns / 1e6, S.CPU_Ns / 1e6);
+        // 没有用 TOY_COUNT_ALLOCATIONS 构建时不统计分配
+        if (Count_Allocations)
+            OS << llvm::format("%11.1f", S.Alloc_Bytes / 1024.0);
+        else
+            OS << llvm::right_justify("-", 11);
+        OS << llvm::format("  %9llu  %11llu  %s (%s)\n", (unsigned long long)S.Runs, (unsigned long long)S.Count,
+                           Phase_Names[i], Phase_Units[i]);
+    }
+}
 
-    return 0;
+// 模块的数据布局和三元组跟随 JIT 或 --emit 的目标机器
+static void configure_module(llvm::Module &M)
+{
+    if (TheJIT)
+        M.setDataLayout(TheJIT->getDataLayout());
+    else if (Target_Machine)
+    {
+        M.setTargetTriple(Target_Machine->getTargetTriple().str());
+        M.setDataLayout(Target_Machine->createDataLayout());
+    }
 }
 
-static void init_precedence()
+static void InitializeModule()
 {
-    Operator_Precedence['<'] = 0;
-    Operator_Precedence['-'] = 1;
-    Operator_Precedence['+'] = 2;
-    Operator_Precedence['/'] = 3;
-    Operator_Precedence['*'] = 4;
+    Module_ob = new llvm::Module("my compiler", *TheContext);
+    reset_operator_tables();
+    configure_module(*Module_ob);
 }
 
-static int getBinOpPrecedence()
+// 把当前模块交给 JIT，并为后续的顶层项开启一个新模块
+static void SubmitModule(llvm::orc::ResourceTrackerSP RT = nullptr)
 {
-    // if (!isascii(Current_Token))
-    //     return -1;
+    llvm::orc::ThreadSafeModule TSM(std::unique_ptr<llvm::Module>(Module_ob), TheThreadSafeContext);
+    if (RT)
+        ExitOnErr(TheJIT->addIRModule(RT, std::move(TSM)));
+    else
+        ExitOnErr(TheJIT->addIRModule(std::move(TSM)));
+    InitializeModule();
+}
 
-    if (Operator_Precedence.find(Current_Token) == Operator_Precedence.end()) // not found)
-        return -1;                                                            // not a recognized operator
+// JIT 模式下每个 def 的模块由各自的 ResourceTracker 跟踪，重新定义时先移除旧的模块
+static llvm::StringMap<llvm::orc::ResourceTrackerSP> Definition_Trackers;
+// 被调用者 -> 调用它的 def。这些 def 的机器码直接链接到被调用者的旧地址，旧模块移除后不能再调用
+static llvm::StringMap<llvm::StringSet<>> Definition_Callers;
 
-    int TokPrec = Operator_Precedence[Current_Token];
-    if (TokPrec < 0)
-        return -1;
+// 为名为 Name 的 def 创建新的 ResourceTracker，Deps 是它调用的函数。
+// 已有同名定义时移除它，以及所有直接或间接调用它的 def（需要重新定义）。
+static llvm::orc::ResourceTrackerSP replace_definition(const std::string &Name, const std::vector<std::string> &Deps)
+{
+    std::vector<std::string> Work(1, Name);
+    llvm::StringSet<> Removed;
+    while (!Work.empty())
+    {
+        std::string Def = Work.back();
+        Work.pop_back();
+        llvm::StringMap<llvm::orc::ResourceTrackerSP>::iterator It = Definition_Trackers.find(Def);
+        if (It == Definition_Trackers.end() || !Removed.insert(Def).second)
+            continue;
+        if (llvm::Error Err = It->second->remove())
+            llvm::logAllUnhandledErrors(std::move(Err), llvm::errs(), "error: ");
+        Definition_Trackers.erase(It);
+        if (Def != Name)
+        {
+            llvm::errs() << "note: removed '" << Def << "', which calls the old '" << Name
+                         << "'; define it again before use\n";
+            Function_Protos.erase(Def);
+        }
+        for (const llvm::StringMapEntry<llvm::NoneType> &Caller : Definition_Callers.lookup(Def))
+            Work.push_back(Caller.getKey().str());
+    }
 
-    return TokPrec;
+    for (const llvm::StringMapEntry<llvm::NoneType> &Def : Removed)
+        for (llvm::StringMapEntry<llvm::StringSet<>> &Callers : Definition_Callers)
+            Callers.getValue().erase(Def.getKey());
+    for (const std::string &Dep : Deps)
+        if (Dep != Name)
+            Definition_Callers[Dep].insert(Name);
+
+    llvm::orc::ResourceTrackerSP RT = TheJIT->getMainJITDylib().createResourceTracker();
+    Definition_Trackers[Name] = RT;
+    return RT;
 }
 
-static BaseAST *binary_op_parser(int Old_Prec, BaseAST *LHS)
+// 持久化编译缓存：每个 def 优化后的单函数模块以 bitcode 形式保存在 <dir>/<key>.bc 中
+class CompileCache
 {
-    while (1)
+    std::string Dir;
+    unsigned Hits = 0;
+    unsigned Misses = 0;
+
+    std::string getPath(llvm::StringRef Key) const { return Dir + "/" + Key.str() + ".bc"; }
+
+public:
+    explicit CompileCache(const std::string &dir) : Dir(dir) {}
+
+    std::unique_ptr<llvm::Module> lookup(llvm::StringRef Key)
     {
-        int Operator_Prec = getBinOpPrecedence();
-        if (Operator_Prec < Old_Prec)
-            return LHS;
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer = llvm::MemoryBuffer::getFile(getPath(Key));
+        if (Buffer)
+        {
+            llvm::Expected<std::unique_ptr<llvm::Module>> M =
+                llvm::parseBitcodeFile((*Buffer)->getMemBufferRef(), *TheContext);
+            if (M)
+            {
+                ++Hits;
+                return std::move(*M);
+            }
+            // 损坏的缓存项按未命中处理，稍后被覆盖
+            llvm::consumeError(M.takeError());
+        }
+        ++Misses;
+        return nullptr;
+    }
 
-        int BinOp = Current_Token;
-        next_token();
+    void store(llvm::StringRef Key, const llvm::Module &M)
+    {
+        // 先写临时文件再改名，多个 toy 进程共享缓存目录时不会读到写了一半的文件
+        int FD;
+        llvm::SmallString<128> Tmp_Path;
+        if (llvm::sys::fs::createUniqueFile(Dir + "/%%%%%%%%.tmp", FD, Tmp_Path))
+            return;
+        {
+            llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+            llvm::WriteBitcodeToFile(M, OS);
+        }
+        if (llvm::sys::fs::rename(Tmp_Path, getPath(Key)))
+            llvm::sys::fs::remove(Tmp_Path);
+    }
 
-        BaseAST *RHS = unary_parser();
-        if (!RHS)
-            return 0;
+    unsigned getHits() const { return Hits; }
+    unsigned getMisses() const { return Misses; }
+};
+
+static std::unique_ptr<CompileCache> Compile_Cache;
+// 构造 Linker 要扫描整个目标模块，因此整个运行期间复用同一个
+static std::unique_ptr<llvm::Linker> Module_Linker;
+// 已生成的 def 的缓存键，调用它们的函数把这些键并入自己的键
+static llvm::StringMap<std::string> Definition_Keys;
+
+// 键覆盖 def 的源码文本、编译选项，以及它所依赖的函数的键（依赖的键又递归覆盖了它们自己的依赖）
+static std::string compute_definition_key(llvm::StringRef Name, llvm::StringRef Source)
+{
+    llvm::SHA1 Hasher;
+    Hasher.update(LLVM_VERSION_STRING);
+    Hasher.update(std::string("-O") + (char)OptLevel);
+    Hasher.update(TheJIT ? "jit" : "module");
+    Hasher.update(SimplifyAST ? "simplify-ast" : "");
+    Hasher.update(Module_ob->getTargetTriple());
+    if (Target_Machine)
+    {
+        Hasher.update(Target_Machine->getTargetCPU());
+        Hasher.update(Target_Machine->getTargetFeatureString());
+    }
+    Hasher.update(Source);
+
+    std::sort(Current_Deps.begin(), Current_Deps.end());
+    Current_Deps.erase(std::unique(Current_Deps.begin(), Current_Deps.end()), Current_Deps.end());
+    for (const std::string &Dep : Current_Deps)
+    {
+        llvm::StringMap<std::string>::iterator It = Definition_Keys.find(Dep);
+        if (Dep == Name || It == Definition_Keys.end())
+            continue;
+        Hasher.update(Dep);
+        Hasher.update(It->second);
+    }
+    return llvm::toHex(Hasher.final(), /*LowerCase=*/true);
+}
 
-        int Next_Prec = getBinOpPrecedence();
-        if (Operator_Prec < Next_Prec)
+// 缓存键使用的 def 文本：第一个记号到最后一个记号之间去掉注释，连续的空白压缩成一个空格，
+// 只改动注释或排版时仍然命中缓存
+static std::string definition_token_text(const char *Begin, const char *End)
+{
+    std::string Text;
+    bool Separator = false;
+    const char *P = Begin;
+    while (P != End)
+    {
+        if (*P == '#')
         {
-            RHS = binary_op_parser(Operator_Prec + 1, RHS);
-            if (!RHS)
-                return 0;
+            while (P != End && *P != '\n' && *P != '\r')
+                ++P;
+            Separator = true;
+        }
+        else if (llvm::isSpace(*P))
+        {
+            ++P;
+            Separator = true;
+        }
+        else
+        {
+            if (Separator && !Text.empty())
+                Text += ' ';
+            Separator = false;
+            Text += *P++;
         }
-        LHS = new BinaryAST(std::to_string(BinOp), LHS, RHS);
     }
+    return Text;
 }
 
-static BaseAST *paran_parser()
+static void HandleCachedDefn(FunctionDefnAST *F, llvm::StringRef Source)
 {
-    next_token(); // eat '('
+    std::string Key = compute_definition_key(F->getName(), Source);
 
-    BaseAST *V = expression_parser();
+    std::unique_ptr<llvm::Module> M = Compile_Cache->lookup(Key);
+    if (!M)
+    {
+        // 未命中：在单独的模块中生成并优化这个函数，写入缓存后再并入主模块
+        llvm::Module *Main_Module = Module_ob;
+        InitializeModule();
+        llvm::Function *LF = F->codegen();
+        M.reset(Module_ob);
+        Module_ob = Main_Module;
+        reset_operator_tables();
+        if (LF == 0)
+            return;
+        Compile_Cache->store(Key, *M);
+    }
+    F->registerPrototype();
+    Definition_Keys[F->getName()] = Key;
 
-    if (!V)
-        return 0;
+    if (TheJIT)
+        ExitOnErr(TheJIT->addIRModule(replace_definition(F->getName(), Current_Deps),
+                                      llvm::orc::ThreadSafeModule(std::move(M), TheThreadSafeContext)));
+    else
+    {
+        if (!Module_Linker)
+            Module_Linker = std::make_unique<llvm::Linker>(*Module_ob);
+        if (Module_Linker->linkInModule(std::move(M)))
+            llvm::errs() << "failed to link cached definition of " << F->getName() << "\n";
+    }
+}
 
-    if (Current_Token != ')')
-        return 0; // error: expected ')'
+static FunctionDefnAST *top_level_parser();
 
-    return V;
+// 解析一个 def 或顶层表达式，计入解析时间
+static FunctionDefnAST *parse_item(FunctionDefnAST *(*Parser)())
+{
+    PhaseTimer Timer(PHASE_PARSE);
+    return Parser();
 }
 
 static void HandleDefn()
 {
-    if (FunctionDefnAST *F = func_defn_parser())
+    const char *Defn_Start = Token_Start;
+    Current_Deps.clear();
+
+    FunctionDefnAST *F = parse_item(func_defn_parser);
+
+    if (F)
     {
-        if (llvm::Function *LF = F->codegen())
+        if (Compile_Cache)
+        {
+            // def 的记号范围：从 def 关键字到解析器停下之前的最后一个记号
+            HandleCachedDefn(F, definition_token_text(Defn_Start, Prev_Token_End));
+        }
+        else if (F->codegen())
         {
+            // 只记录成功生成的函数，后续模块才能据此重新声明
+            F->registerPrototype();
+            if (TheJIT)
+                SubmitModule(replace_definition(F->getName(), Current_Deps));
         }
     }
     else
     {
         next_token();
     }
+    AST_Arena.reset();
 }
 
 static FunctionDefnAST *top_level_parser()
 {
-    if (BaseAST *E = expression_parser())
+    size_t Body_Start = AST_Arena.getNumNodes();
+    BaseAST *E = expression_parser();
+    if (E)
     {
-        FunctionDeclAST *Func_Decl = new FunctionDeclAST("", std::vector<std::string>());
-        return new FunctionDefnAST(Func_Decl, E);
+        size_t Body_Nodes = AST_Arena.getNumNodes() - Body_Start;
+        FunctionDeclAST *Func_Decl = AST_Arena.create<FunctionDeclAST>(TheJIT ? Anon_Expr_Name : "", std::vector<std::string>(), std::vector<ValueType>(), E->getType());
+        FunctionDefnAST *Defn = AST_Arena.create<FunctionDefnAST>(Func_Decl, E);
+        Defn->simplify(Body_Nodes);
+        return Defn;
     }
 
     return 0;
@@ -816,19 +3354,90 @@ static FunctionDefnAST *top_level_parser()
 
 static void HandleTopExpression()
 {
-    if (FunctionDefnAST *F = top_level_parser())
+    FunctionDefnAST *F = parse_item(top_level_parser);
+
+    if (F)
     {
         if (llvm::Function *LF = F->codegen())
         {
-            // LF->dump();
-            // void *FPtr = TheExecutionEngine->getPointerToFunction(LF);
-            // int (*Int)() = (int (*)())(intptr_t)FPtr;
+            if (TheJIT)
+            {
+                ValueType Ty = get_value_type(LF->getReturnType());
+                const char *Entry = Anon_Expr_Name;
+                if (Ty == TYPE_VEC4)
+                {
+                    // 宿主侧无法按向量 ABI 直接调用，包一层把结果写进调用者给出的 double[4]
+                    llvm::Type *Double_Ptr = llvm::Type::getDoublePtrTy(*TheContext);
+                    llvm::FunctionType *FT = llvm::FunctionType::get(llvm::Type::getVoidTy(*TheContext), Double_Ptr, false);
+                    llvm::Function *W = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "__anon_expr_store", Module_ob);
+                    Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", W));
+                    llvm::Value *Ptr = Builder->CreateBitCast(W->getArg(0), LF->getReturnType()->getPointerTo());
+                    Builder->CreateAlignedStore(Builder->CreateCall(LF), Ptr, llvm::Align(8));
+                    Builder->CreateRetVoid();
+                    Entry = "__anon_expr_store";
+                }
+
+                // 表达式所在模块单独跟踪，执行完即可从 JIT 中释放。
+                // 查找符号时 JIT 才编译模块（连同尚未编译的被调用者），jit 阶段只含编译和链接，执行另计
+                llvm::orc::ResourceTrackerSP RT = TheJIT->getMainJITDylib().createResourceTracker();
+                llvm::JITEvaluatedSymbol Sym;
+                {
+                    PhaseTimer Timer(PHASE_JIT);
+                    count_phase(PHASE_JIT, 1);
+                    SubmitModule(RT);
+                    Sym = ExitOnErr(TheJIT->lookup(Entry));
+                }
+
+                count_phase(PHASE_EXECUTE, 1);
+                if (Ty == TYPE_DOUBLE)
+                {
+                    double (*FP)() = (double (*)())(intptr_t)Sym.getAddress();
+                    double V;
+                    {
+                        PhaseTimer Timer(PHASE_EXECUTE);
+                        V = FP();
+                    }
+                    fprintf(stdout, "Evaluated to %f\n", V);
+                }
+                else if (Ty == TYPE_VEC4)
+                {
+                    double V[4];
+                    void (*FP)(double *) = (void (*)(double *))(intptr_t)Sym.getAddress();
+                    {
+                        PhaseTimer Timer(PHASE_EXECUTE);
+                        FP(V);
+                    }
+                    fprintf(stdout, "Evaluated to <%f, %f, %f, %f>\n", V[0], V[1], V[2], V[3]);
+                }
+                else
+                {
+                    int (*FP)() = (int (*)())(intptr_t)Sym.getAddress();
+                    int V;
+                    {
+                        PhaseTimer Timer(PHASE_EXECUTE);
+                        V = FP();
+                    }
+                    fprintf(stdout, "Evaluated to %d\n", V);
+                }
+                if (Repl)
+                {
+                    // 输出可能接的是管道，结果要立即送出
+                    fflush(stdout);
+                    double Ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Chunk_Ready).count();
+                    Repl_Latencies.push_back(Ms);
+                    if (ReportLatency)
+                        fprintf(stderr, "latency: expression %zu: %.3f ms\n", Repl_Latencies.size(), Ms);
+                }
+
+                ExitOnErr(RT->remove());
+            }
         }
     }
     else
     {
         next_token();
     }
+    AST_Arena.reset();
 }
 
 static void Driver()
@@ -855,28 +3464,497 @@ static void Driver()
     }
 }
 
-int main(int argc, char *argv[])
+// 一段输入中最后一个不在注释里的 ';' 之后的位置，没有时返回 npos
+static size_t find_item_end(const std::string &Text)
+{
+    size_t End = std::string::npos;
+    bool In_Comment = false;
+    for (size_t i = 0, e = Text.size(); i != e; ++i)
+    {
+        if (In_Comment)
+            In_Comment = Text[i] != '\n' && Text[i] != '\r';
+        else if (Text[i] == '#')
+            In_Comment = true;
+        else if (Text[i] == ';')
+            End = i + 1;
+    }
+    return End;
+}
+
+// 把一段完整的输入交给词法分析器，逐项解析并在 JIT 中执行
+static void run_chunk(llvm::StringRef Text)
+{
+    Chunk_Ready = std::chrono::steady_clock::now();
+    Input_Buffer = llvm::MemoryBuffer::getMemBufferCopy(Text, "<stdin>");
+    Input_Bytes += Text.size();
+    reset_lexer();
+    measure_lexing();
+    next_token();
+    Driver();
+}
+
+// -repl 模式：按行读入，读到以 ';' 结束的顶层项就立即处理，不等整个输入结束；
+// 每个 def 和顶层表达式各自成为一个模块交给 JIT，后面的模块通过 JIT 的符号表调用前面的 def
+static int ReplDriver()
+{
+    FILE *In = InputFilename == "-" ? stdin : fopen(InputFilename.c_str(), "r");
+    if (!In)
+    {
+        printf("File not found.\n");
+        return 1;
+    }
+
+    std::string Pending;
+    char Line[4096];
+    while (fgets(Line, sizeof(Line), In))
+    {
+        Pending += Line;
+        size_t End = find_item_end(Pending);
+        if (End == std::string::npos)
+            continue;
+        run_chunk(llvm::StringRef(Pending).take_front(End));
+        Pending.erase(0, End);
+    }
+    if (llvm::StringRef(Pending).find_first_not_of(" \t\r\n") != llvm::StringRef::npos)
+        run_chunk(Pending);
+
+    if (In != stdin)
+        fclose(In);
+    return 0;
+}
+
+// 表达式延迟的汇总：平均值、中位数、p99 和最大值
+static void ReportReplLatency()
+{
+    if (Repl_Latencies.empty())
+        return;
+    std::vector<double> Sorted(Repl_Latencies);
+    std::sort(Sorted.begin(), Sorted.end());
+    double Sum = 0;
+    for (double Ms : Sorted)
+        Sum += Ms;
+    size_t N = Sorted.size();
+    fprintf(stderr, "latency: %zu expressions, mean %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", N, Sum / N,
+            Sorted[N / 2], Sorted[std::min(N - 1, N * 99 / 100)], Sorted.back());
+}
+
+// -j 模式：先解析整个文件，再把 def 和顶层表达式按源码顺序切成若干批，由线程池并行生成和优化。
+// 每批在独立的 LLVMContext 和模块中生成，序列化为 bitcode 后按批次顺序链接进主模块，输出顺序与串行模式一致。
+struct CompileBatch
+{
+    size_t Begin, End;
+    llvm::SmallVector<char, 0> Bitcode;
+};
+
+// 每项最近一次生成是否失败（只对 def 有意义），各批只写自己的项
+static std::vector<char> Item_Failed;
+
+static std::mutex Worker_Stats_Mutex;
+static unsigned Worker_Optimized_Functions;
+static Phase_Stats Worker_Phases[NUM_PHASES];
+
+static void merge_phases(Phase_Stats *Into, const Phase_Stats *From)
+{
+    for (unsigned i = 0; i != NUM_PHASES; ++i)
+    {
+        Into[i].Wall_Ns += From[i].Wall_Ns;
+        Into[i].CPU_Ns += From[i].CPU_Ns;
+        Into[i].Alloc_Bytes += From[i].Alloc_Bytes;
+        Into[i].Runs += From[i].Runs;
+        Into[i].Count += From[i].Count;
+    }
+}
+
+static void compile_batch(const std::vector<FunctionDefnAST *> &Items, CompileBatch &Batch)
+{
+    llvm::LLVMContext Context;
+    llvm::IRBuilder<> Batch_Builder(Context);
+    llvm::Module M("my compiler", Context);
+    TheContext = &Context;
+    Builder = &Batch_Builder;
+    Module_ob = &M;
+    reset_operator_tables();
+    // TargetMachine 和优化流水线归本批所有，批次结束时释放，线程池的线程不留下任何对象
+    std::unique_ptr<llvm::TargetMachine> Batch_Target_Machine;
+    if (needs_target_machine())
+        Batch_Target_Machine.reset(create_target_machine());
+    Target_Machine = Batch_Target_Machine.get();
+    configure_module(M);
+    InitializeOptimizer();
+
+    Num_Optimized_Functions = 0;
+    std::fill(Phases, Phases + NUM_PHASES, Phase_Stats());
+
+    for (size_t i = Batch.Begin; i != Batch.End; ++i)
+    {
+        Current_Item = i;
+        Item_Callees[i].clear();
+        const std::string &Name = Items[i]->getName();
+        // 前面已经有同名的 def 时，串行模式下这次定义会失败
+        if (!Name.empty())
+        {
+            Item_Callees[i].push_back(Name);
+            Item_Failed[i] = proto_visible(Name) || Items[i]->codegen() == 0;
+        }
+        else
+            Items[i]->codegen();
+    }
+    Current_Item = SIZE_MAX;
+
+    // 保留 use-list 的顺序：否则读回后块的前驱等顺序与串行模式不同，模块级内联和 InstCombine 会据此做出不同的选择
+    llvm::raw_svector_ostream OS(Batch.Bitcode);
+    llvm::WriteBitcodeToFile(M, OS, /*ShouldPreserveUseListOrder=*/true);
+
+    ReleaseOptimizer();
+    Target_Machine = nullptr;
+    Module_ob = nullptr;
+    Builder = nullptr;
+    TheContext = nullptr;
+
+    std::lock_guard<std::mutex> Lock(Worker_Stats_Mutex);
+    Worker_Optimized_Functions += Num_Optimized_Functions;
+    merge_phases(Worker_Phases, Phases);
+}
+
+static void compile_batches(const std::vector<FunctionDefnAST *> &Items, std::vector<CompileBatch> &Batches,
+                            const std::vector<char> &Rebuild)
 {
-    llvm::LLVMContext &Context = TheGlobalContext;
+    llvm::ThreadPool Pool(llvm::hardware_concurrency(Threads));
+    for (size_t b = 0, e = Batches.size(); b != e; ++b)
+    {
+        if (!Rebuild[b])
+            continue;
+        CompileBatch &Batch = Batches[b];
+        Batch.Bitcode.clear();
+        Pool.async([&Items, &Batch]() { compile_batch(Items, Batch); });
+    }
+    Pool.wait();
+}
 
+// 丢弃 -j 的解析结果，从头按串行模式解析和生成整个文件
+static void reparse_serially()
+{
+    Function_Protos.clear();
+    Proto_Items.clear();
+    Item_Callees.clear();
+    Item_Failed.clear();
     init_precedence();
+    Simplify_Nodes_Before = Simplify_Nodes_After = 0;
+    AST_Arena.reset();
+
+    Quiet_Lexer = true;
+    reset_lexer();
+    next_token();
+    Driver();
+    Quiet_Lexer = false;
+}
+
+static void ParallelDriver()
+{
+    // 解析阶段：登记每个名字第一个 def 的原型，工作线程之后只读 Function_Protos 和 Proto_Items
+    std::vector<FunctionDefnAST *> Items;
+    while (Current_Token != EOF_TOKEN)
+    {
+        if (Current_Token == ';')
+        {
+            next_token();
+            continue;
+        }
+
+        bool Is_Defn = Current_Token == DEF_TOKEN;
+        FunctionDefnAST *F = parse_item(Is_Defn ? func_defn_parser : top_level_parser);
+
+        if (F == 0)
+        {
+            next_token();
+            continue;
+        }
+        if (Is_Defn)
+        {
+            // 只登记第一个定义的原型：之后的同名 def 在串行模式下会失败，不能覆盖它的签名
+            std::vector<size_t> &Defs = Proto_Items[F->getName()];
+            if (Defs.empty())
+                F->registerPrototype();
+            Defs.push_back(Items.size());
+        }
+        Items.push_back(F);
+    }
+
+    // 批次数取线程数的若干倍，避免个别大函数拖慢整体
+    size_t Batch_Size = std::max<size_t>(1, Items.size() / (Threads * 8));
+    std::vector<CompileBatch> Batches;
+    for (size_t Begin = 0; Begin < Items.size(); Begin += Batch_Size)
+    {
+        Batches.push_back(CompileBatch());
+        Batches.back().Begin = Begin;
+        Batches.back().End = std::min(Items.size(), Begin + Batch_Size);
+    }
+
+    std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+    Item_Callees.assign(Items.size(), std::vector<std::string>());
+    Item_Failed.assign(Items.size(), false);
+    std::vector<char> Rebuild(Batches.size(), true);
+    compile_batches(Items, Batches, Rebuild);
+
+    // 串行模式下生成失败的 def 不登记原型，后面调用它的项也会失败。第一轮假定所有 def 都成功，
+    // 再按源码顺序走一遍：失败的 def 从可见原型中去掉，之后查找过这个名字的项单独重新生成一次，
+    // 得到它在串行模式下的结果，失败会继续传递给更后面的项。没有错误时不重新生成任何项
+    std::fill(Rebuild.begin(), Rebuild.end(), false);
+    std::set<std::string> Changed;
+    bool Serial_Fallback = false;
+    {
+        llvm::ThreadPool Single(llvm::hardware_concurrency(1));
+        for (size_t i = 0, e = Items.size(); i != e; ++i)
+        {
+            bool Stale = false;
+            for (const std::string &Callee : Item_Callees[i])
+                Stale |= Changed.count(Callee) != 0;
+            if (Stale)
+            {
+                // 工作线程有自己的 LLVMContext 和线程局部状态，不能在主线程上生成
+                CompileBatch Item;
+                Item.Begin = i;
+                Item.End = i + 1;
+                Single.async([&Items, &Item]() { compile_batch(Items, Item); });
+                Single.wait();
+                Rebuild[i / Batch_Size] = true;
+            }
+
+            const std::string &Name = Items[i]->getName();
+            if (!Name.empty() && Item_Failed[i])
+            {
+                std::vector<size_t> &Defs = Proto_Items[Name];
+                bool Was_First = Defs.front() == i;
+                Defs.erase(std::remove(Defs.begin(), Defs.end(), i), Defs.end());
+                if (Was_First && !Defs.empty())
+                {
+                    // 串行模式下接下来登记的是下一个同名 def 的原型。返回类型不同时，之后的调用在串行模式下
+                    // 按新的返回类型解析，而这里已经按第一个 def 解析完了，只能整个文件按串行模式重新来过
+                    if (Items[Defs.front()]->getReturnType() != Items[i]->getReturnType())
+                    {
+                        Serial_Fallback = true;
+                        break;
+                    }
+                    Items[Defs.front()]->registerPrototype();
+                }
+                Changed.insert(Name);
+            }
+        }
+    }
+    if (Serial_Fallback)
+    {
+        reparse_serially();
+        return;
+    }
+    // 包含重新生成过的项的批次按最终的可见原型整批重新生成
+    compile_batches(Items, Batches, Rebuild);
+    std::chrono::steady_clock::time_point Generated = std::chrono::steady_clock::now();
+    Parallel_Time += Generated - Start;
+
+    Num_Optimized_Functions += Worker_Optimized_Functions;
+    merge_phases(Phases, Worker_Phases);
+
+    PhaseTimer Timer(PHASE_LINK);
+    count_phase(PHASE_LINK, Batches.size());
+    llvm::Linker Batch_Linker(*Module_ob);
+    for (CompileBatch &Batch : Batches)
+    {
+        llvm::MemoryBufferRef Ref(llvm::StringRef(Batch.Bitcode.data(), Batch.Bitcode.size()), "batch");
+        std::unique_ptr<llvm::Module> M = ExitOnErr(llvm::parseBitcodeFile(Ref, *TheContext));
+        if (Batch_Linker.linkInModule(std::move(M)))
+            llvm::errs() << "failed to link batch starting at item " << Batch.Begin << "\n";
+    }
 
-    // llvm::EngineBuilder EB;
-    // TheExecutionEngine = EB.create();
+    AST_Arena.reset();
+}
+
+// 分别用缓冲区词法分析器和 fgetc 词法分析器扫描整个输入，报告 MB/s
+static int benchmark_lexer()
+{
+    typedef std::chrono::duration<double> Seconds;
+    double MB = Input_Buffer->getBufferSize() / (1024.0 * 1024.0);
+
+    std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+    size_t Buffered_Tokens = 0;
+    while (get_token() != EOF_TOKEN)
+        ++Buffered_Tokens;
+    double Buffered_Secs = Seconds(std::chrono::steady_clock::now() - Start).count();
 
-    file = fopen(argv[1], "r");
+    FILE *file = fopen(InputFilename.c_str(), "r");
     if (file == 0)
     {
         printf("File not found.\n");
+        return 1;
     }
+    std::string Legacy_Identifier;
+    Start = std::chrono::steady_clock::now();
+    size_t Legacy_Tokens = 0;
+    while (legacy_get_token(file, Legacy_Identifier) != EOF_TOKEN)
+        ++Legacy_Tokens;
+    double Legacy_Secs = Seconds(std::chrono::steady_clock::now() - Start).count();
+    fclose(file);
+
+    llvm::outs() << "input: " << llvm::format("%.2f", MB) << " MB\n";
+    llvm::outs() << "buffered lexer: " << Buffered_Tokens << " tokens, " << llvm::format("%.1f", MB / Buffered_Secs)
+                 << " MB/s\n";
+    llvm::outs() << "fgetc lexer:    " << Legacy_Tokens << " tokens, " << llvm::format("%.1f", MB / Legacy_Secs)
+                 << " MB/s\n";
+    return Buffered_Tokens == Legacy_Tokens ? 0 : 1;
+}
 
-    next_token();
+// 按 --emit 写出主模块：ll/bc 直接序列化，asm/obj 经 TargetMachine 的代码生成流水线
+static int EmitOutput()
+{
+    std::string Filename = OutputFilename;
+    if (Filename.empty())
+    {
+        if (Emit == EMIT_LL || InputFilename == "-")
+            Filename = "-";
+        else
+        {
+            llvm::SmallString<128> Path(InputFilename);
+            llvm::sys::path::replace_extension(Path, Emit == EMIT_BC ? "bc" : Emit == EMIT_ASM ? "s" : "o");
+            Filename = std::string(Path.str());
+        }
+    }
 
-    Module_ob = new llvm::Module("my compiler", Context);
+    PhaseTimer Timer(PHASE_OUTPUT);
+    std::error_code EC;
+    llvm::ToolOutputFile Out(Filename, EC,
+                             Emit == EMIT_LL || Emit == EMIT_ASM ? llvm::sys::fs::OF_Text : llvm::sys::fs::OF_None);
+    if (EC)
+    {
+        llvm::errs() << "cannot open " << Filename << ": " << EC.message() << "\n";
+        return 1;
+    }
 
-    Driver();
+    if (Emit == EMIT_LL)
+        Module_ob->print(Out.os(), 0);
+    else if (Emit == EMIT_BC)
+        llvm::WriteBitcodeToFile(*Module_ob, Out.os());
+    else
+    {
+        llvm::legacy::PassManager PM;
+        if (Target_Machine->addPassesToEmitFile(PM, Out.os(), nullptr,
+                                                Emit == EMIT_ASM ? llvm::CGFT_AssemblyFile : llvm::CGFT_ObjectFile))
+        {
+            llvm::errs() << "target cannot emit this kind of file\n";
+            return 1;
+        }
+        PM.run(*Module_ob);
+    }
+
+    count_phase(PHASE_OUTPUT, Out.os().tell());
+    Out.keep();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    llvm::cl::ParseCommandLineOptions(argc, argv, "toy compiler\n");
+    std::chrono::steady_clock::time_point Program_Start = std::chrono::steady_clock::now();
+
+    TheContext = TheThreadSafeContext.getContext();
+    Builder = &Main_Builder;
+
+    if (Repl)
+        UseJIT = true;
+    if (Threads && (UseJIT || !CacheDir.empty()))
+    {
+        llvm::errs() << "-j cannot be combined with -jit or -cache-dir\n";
+        return 1;
+    }
+    if (CompileOnly)
+        Emit = EMIT_OBJ;
+    if (UseJIT && (Emit != EMIT_LL || !OutputFilename.empty()))
+    {
+        llvm::errs() << "-jit cannot be combined with -c, -o or --emit\n";
+        return 1;
+    }
+
+    init_precedence();
+    if (needs_target_machine())
+    {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        Target_Machine = create_target_machine();
+        if (!Target_Machine)
+            return 1;
+    }
+    InitializeOptimizer();
+
+    if (UseJIT)
+    {
+        llvm::Optional<llvm::orc::JITTargetMachineBuilder> JTMB = jit_target_machine_builder();
+        if (!JTMB)
+            return 1;
+        TheJIT = ExitOnErr(llvm::orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(*JTMB)).create());
+        // 允许调用宿主进程中的符号（如 putchar）
+        TheJIT->getMainJITDylib().addGenerator(ExitOnErr(
+            llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(TheJIT->getDataLayout().getGlobalPrefix())));
+    }
+
+    if (!CacheDir.empty())
+    {
+        if (std::error_code EC = llvm::sys::fs::create_directories(CacheDir))
+        {
+            llvm::errs() << "cannot create cache directory " << CacheDir << ": " << EC.message() << "\n";
+            return 1;
+        }
+        Compile_Cache = std::make_unique<CompileCache>(CacheDir);
+    }
+
+    if (Repl)
+    {
+        InitializeModule();
+        if (ReplDriver())
+            return 1;
+    }
+    else
+    {
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> BufferOrErr = llvm::MemoryBuffer::getFileOrSTDIN(InputFilename);
+        if (!BufferOrErr)
+        {
+            printf("File not found.\n");
+            return 1;
+        }
+        Input_Buffer = std::move(*BufferOrErr);
+        Input_Bytes = Input_Buffer->getBufferSize();
+        reset_lexer();
+        measure_lexing();
+
+        if (BenchLex)
+            return benchmark_lexer();
+
+        next_token();
+
+        InitializeModule();
+
+        if (Threads)
+            ParallelDriver();
+        else
+            Driver();
+    }
 
-    Module_ob->print(llvm::outs(), 0);
+    OptimizeModule();
+
+    if (!TheJIT && EmitOutput())
+        return 1;
+
+    if (ReportCompileTime)
+        ReportOptimizerTime();
+    if (ReportMemory)
+        ReportMemoryUsage();
+    if (ReportLatency)
+        ReportReplLatency();
+    if (PhaseStats)
+        ReportPhaseStats(Program_Start);
+    if (ReportSimplify)
+        llvm::errs() << "AST simplification: " << Simplify_Nodes_Before << " -> " << Simplify_Nodes_After
+                     << " nodes, removed " << Simplify_Nodes_Before - Simplify_Nodes_After << "\n";
+    if (Compile_Cache)
+        llvm::errs() << "compile cache: " << Compile_Cache->getHits() << " hits, " << Compile_Cache->getMisses()
+                     << " misses\n";
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,128 @@
+// toy 前端的基准测试：用 Google Benchmark 反复运行 toy，每次读取 -phase-stats 的 JSON，
+// 把词法、解析、代码生成、优化、JIT 执行等阶段的耗时分别作为计数器报告。
+// 迭代时间取 toy 进程自己统计的总墙钟时间（不含进程启动）。
+//
+//   ./gen_workload -defs=2000 > defs.toy
+//   ./toy_bench -toy=./toy -O=0,2 defs.toy --benchmark_repetitions=5 --benchmark_format=json
+#include <map>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+
+static llvm::cl::list<std::string> Inputs(llvm::cl::Positional, llvm::cl::OneOrMore,
+                                          llvm::cl::desc("<toy programs>"));
+static llvm::cl::opt<std::string> Toy_Path("toy", llvm::cl::init("./toy"), llvm::cl::desc("toy compiler to run"));
+static llvm::cl::list<unsigned> Opt_Levels("O", llvm::cl::CommaSeparated, llvm::cl::Prefix,
+                                           llvm::cl::desc("Optimization levels to measure (default = 0,2)"));
+static llvm::cl::opt<bool> Use_JIT("jit", llvm::cl::init(true),
+                                   llvm::cl::desc("Run top-level expressions in the JIT so execution is measured "
+                                                  "(default = on; off measures IR output instead)"));
+
+// 一次 toy 运行：返回 -phase-stats 的 JSON，失败时返回 None 并设置 Error
+static llvm::Optional<llvm::json::Value> run_toy(const std::string &Input, unsigned Opt_Level, std::string &Error)
+{
+    llvm::SmallString<128> Stats_File;
+    if (llvm::sys::fs::createTemporaryFile("toy-bench", "json", Stats_File))
+    {
+        Error = "cannot create temporary file";
+        return llvm::None;
+    }
+
+    std::string Opt_Arg = "-O=" + std::to_string(Opt_Level);
+    std::string Stats_Arg = "-phase-stats-file=" + std::string(Stats_File.str());
+    std::vector<llvm::StringRef> Args = {Toy_Path, Opt_Arg, "-phase-stats", "-phase-stats-format=json", Stats_Arg};
+    if (Use_JIT)
+        Args.push_back("-jit");
+    Args.push_back(Input);
+
+    // 程序输出丢弃，只保留统计
+    llvm::Optional<llvm::StringRef> Redirects[] = {llvm::None, llvm::StringRef(""), llvm::StringRef("")};
+    int Status = llvm::sys::ExecuteAndWait(Toy_Path, Args, llvm::None, Redirects, 0, 0, &Error);
+
+    llvm::Optional<llvm::json::Value> Result;
+    if (Status != 0)
+    {
+        if (Error.empty())
+            Error = Toy_Path + " exited with status " + std::to_string(Status);
+    }
+    else if (llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer = llvm::MemoryBuffer::getFile(Stats_File))
+    {
+        llvm::Expected<llvm::json::Value> Parsed = llvm::json::parse((*Buffer)->getBuffer());
+        if (Parsed)
+            Result = std::move(*Parsed);
+        else
+            Error = llvm::toString(Parsed.takeError());
+    }
+    else
+        Error = "cannot read " + std::string(Stats_File.str());
+
+    llvm::sys::fs::remove(Stats_File);
+    return Result;
+}
+
+static void BM_Toy(benchmark::State &State, std::string Input, unsigned Opt_Level)
+{
+    std::map<std::string, double> Phase_Ms;
+    double Input_Bytes = 0;
+    for (auto _ : State)
+    {
+        std::string Error;
+        llvm::Optional<llvm::json::Value> Stats = run_toy(Input, Opt_Level, Error);
+        const llvm::json::Object *Root = Stats ? Stats->getAsObject() : nullptr;
+        const llvm::json::Object *Phases = Root ? Root->getObject("phases") : nullptr;
+        if (!Phases)
+        {
+            State.SkipWithError(Error.empty() ? "malformed -phase-stats output" : Error.c_str());
+            return;
+        }
+
+        State.SetIterationTime(Root->getNumber("wall_ms").getValueOr(0) / 1e3);
+        Input_Bytes = Root->getNumber("input_bytes").getValueOr(0);
+        for (const llvm::json::Object::value_type &Phase : *Phases)
+        {
+            const llvm::json::Object *P = Phase.second.getAsObject();
+            if (P && P->getInteger("runs").getValueOr(0) != 0)
+                Phase_Ms[Phase.first.str()] += P->getNumber("wall_ms").getValueOr(0);
+        }
+    }
+
+    // 各阶段按迭代平均，单位毫秒
+    for (const std::pair<const std::string, double> &P : Phase_Ms)
+        State.counters[P.first + "_ms"] = benchmark::Counter(P.second, benchmark::Counter::kAvgIterations);
+    State.SetBytesProcessed((int64_t)(Input_Bytes * State.iterations()));
+}
+
+int main(int argc, char *argv[])
+{
+    // Google Benchmark 先取走 --benchmark_* 参数，其余交给 llvm::cl
+    benchmark::Initialize(&argc, argv);
+    llvm::cl::ParseCommandLineOptions(argc, argv, "toy front-end benchmark\n");
+
+    if (Opt_Levels.empty())
+    {
+        Opt_Levels.push_back(0);
+        Opt_Levels.push_back(2);
+    }
+
+    for (const std::string &Input : Inputs)
+        for (unsigned Level : Opt_Levels)
+        {
+            std::string Name = "toy/" + llvm::sys::path::filename(Input).str() + "/O" + std::to_string(Level);
+            benchmark::RegisterBenchmark(Name.c_str(), BM_Toy, Input, Level)
+                ->UseManualTime()
+                ->Unit(benchmark::kMillisecond);
+        }
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
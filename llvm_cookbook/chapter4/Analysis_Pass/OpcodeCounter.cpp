@@ -1,49 +1,593 @@
 #include "llvm/Pass.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
-#include <map>
+#include <algorithm>
+#include <cstring>
+#include <vector>
 
 #define DEBUG_TYPE "opcodeCounter"
 
 using namespace llvm;
 
+enum Histogram_Format
+{
+    HISTOGRAM_TEXT,
+    HISTOGRAM_JSON,
+    HISTOGRAM_CSV
+};
+static cl::opt<Histogram_Format> HistogramFormat("opcode-histogram-format", cl::init(HISTOGRAM_TEXT),
+                                                 cl::desc("Format of the -opcode-histogram and -opcode-profile "
+                                                          "reports"),
+                                                 cl::values(clEnumValN(HISTOGRAM_TEXT, "text", "Table (default)"),
+                                                            clEnumValN(HISTOGRAM_JSON, "json", "JSON object"),
+                                                            clEnumValN(HISTOGRAM_CSV, "csv", "Comma-separated rows")));
+static cl::opt<std::string> HistogramFile("opcode-histogram-file", cl::value_desc("filename"),
+                                          cl::desc("Write the -opcode-histogram or -opcode-profile report to this "
+                                                   "file instead of stdout"));
+static cl::opt<unsigned> HistogramThreads("opcode-histogram-threads", cl::init(0),
+                                          cl::desc("Threads counting functions for -opcode-histogram "
+                                                   "(0 = all hardware threads, 1 = no thread pool)"));
+static cl::opt<unsigned> ProfileFunctions("opcode-profile-functions", cl::init(10),
+                                          cl::desc("Number of hottest functions listed by -opcode-profile"));
+
 namespace
 {
-    struct CountOpcode : public FunctionPass
+    // 以 Instruction::getOpcode() 为下标的计数，每条指令一次数组自增，不再查找字符串键
+    struct OpcodeCounts
     {
-        static char ID;
-        CountOpcode() : FunctionPass(ID) {}
+        uint64_t Counts[Instruction::OtherOpsEnd];
 
-        std::map<std::string, int> opcodeCounter;
+        OpcodeCounts() { memset(Counts, 0, sizeof(Counts)); }
+
+        void add(const Function &F)
+        {
+            for (const BasicBlock &BB : F)
+                for (const Instruction &I : BB)
+                    ++Counts[I.getOpcode()];
+        }
+
+        void merge(const OpcodeCounts &Other)
+        {
+            for (unsigned i = 0; i != Instruction::OtherOpsEnd; ++i)
+                Counts[i] += Other.Counts[i];
+        }
+
+        uint64_t total() const
+        {
+            uint64_t Sum = 0;
+            for (uint64_t C : Counts)
+                Sum += C;
+            return Sum;
+        }
+
+        // 出现过的操作码，Compare 决定顺序
+        template <typename Compare>
+        std::vector<unsigned> opcodes(Compare Less) const
+        {
+            std::vector<unsigned> Opcodes;
+            for (unsigned i = 0; i != Instruction::OtherOpsEnd; ++i)
+                if (Counts[i])
+                    Opcodes.push_back(i);
+            std::sort(Opcodes.begin(), Opcodes.end(), Less);
+            return Opcodes;
+        }
+    };
+
+    bool nameLess(unsigned A, unsigned B)
+    {
+        return strcmp(Instruction::getOpcodeName(A), Instruction::getOpcodeName(B)) < 0;
+    }
+
+    OpcodeCounts countOpcodes(Function &F)
+    {
+        OpcodeCounts opcodeCounter;
+        opcodeCounter.add(F);
+        return opcodeCounter;
+    }
+
+    // 每个函数一段，按操作码名字排序
+    void printOpcodes(StringRef Name, const OpcodeCounts &opcodeCounter)
+    {
+        outs() << "Function: " << Name << "\n";
+        for (unsigned Op : opcodeCounter.opcodes(nameLess))
+            outs() << Instruction::getOpcodeName(Op) << ": " << opcodeCounter.Counts[Op] << "\n";
+        outs() << "\n";
+    }
+
+    // 整个模块的直方图：函数分批交给线程池，每批有自己的计数，最后合并，线程之间不共享可写数据
+    struct ModuleHistogram
+    {
+        OpcodeCounts Total;
+        unsigned Num_Functions = 0;
+        unsigned Num_Threads = 1;
+    };
+
+    struct CountBatch
+    {
+        size_t Begin, End;
+        OpcodeCounts Counts;
+    };
+
+    ModuleHistogram countModule(Module &M)
+    {
+        ModuleHistogram H;
+        std::vector<const Function *> Functions;
+        for (const Function &F : M)
+            if (!F.isDeclaration())
+                Functions.push_back(&F);
+        H.Num_Functions = Functions.size();
+
+        if (HistogramThreads == 1 || Functions.size() < 2)
+        {
+            for (const Function *F : Functions)
+                H.Total.add(*F);
+            return H;
+        }
+
+        ThreadPoolStrategy Strategy = hardware_concurrency(HistogramThreads);
+        H.Num_Threads = Strategy.compute_thread_count();
+
+        // 批次数取线程数的若干倍，避免个别大函数拖慢整体
+        size_t Batch_Size = std::max<size_t>(1, Functions.size() / (H.Num_Threads * 8));
+        std::vector<CountBatch> Batches;
+        for (size_t Begin = 0; Begin < Functions.size(); Begin += Batch_Size)
+        {
+            Batches.push_back(CountBatch());
+            Batches.back().Begin = Begin;
+            Batches.back().End = std::min(Functions.size(), Begin + Batch_Size);
+        }
 
-        virtual bool runOnFunction(Function &F) override
         {
-            outs() << "Function: " << F.getName() << "\n";
-            for (Function::iterator bb = F.begin(); bb != F.end(); ++bb)
+            ThreadPool Pool(Strategy);
+            for (CountBatch &Batch : Batches)
+                Pool.async([&Functions, &Batch]()
+                           {
+                               for (size_t i = Batch.Begin; i != Batch.End; ++i)
+                                   Batch.Counts.add(*Functions[i]);
+                           });
+            Pool.wait();
+        }
+
+        for (const CountBatch &Batch : Batches)
+            H.Total.merge(Batch.Counts);
+        return H;
+    }
+
+    void writeHistogram(raw_ostream &OS, const Module &M, const ModuleHistogram &H, Histogram_Format Format)
+    {
+        const OpcodeCounts &C = H.Total;
+        uint64_t Total = C.total();
+        // 数量从大到小，相同时按名字
+        std::vector<unsigned> Opcodes = C.opcodes([&C](unsigned A, unsigned B)
+                                                  { return C.Counts[A] != C.Counts[B] ? C.Counts[A] > C.Counts[B]
+                                                                                      : nameLess(A, B); });
+        auto percent = [Total](uint64_t N) { return Total ? N * 100.0 / Total : 0.0; };
+
+        if (Format == HISTOGRAM_JSON)
+        {
+            json::OStream J(OS, 2);
+            J.object([&]
+                     {
+                         J.attribute("module", M.getModuleIdentifier());
+                         J.attribute("functions", (int64_t)H.Num_Functions);
+                         J.attribute("instructions", (int64_t)Total);
+                         J.attribute("threads", (int64_t)H.Num_Threads);
+                         J.attributeObject("opcodes", [&]
+                                           {
+                                               for (unsigned Op : Opcodes)
+                                                   J.attribute(Instruction::getOpcodeName(Op), (int64_t)C.Counts[Op]);
+                                           });
+                     });
+            OS << "\n";
+            return;
+        }
+
+        if (Format == HISTOGRAM_CSV)
+        {
+            OS << "opcode,count,percent\n";
+            for (unsigned Op : Opcodes)
+                OS << Instruction::getOpcodeName(Op) << "," << C.Counts[Op] << ","
+                   << format("%.3f", percent(C.Counts[Op])) << "\n";
+            return;
+        }
+
+        OS << "Module: " << M.getModuleIdentifier() << "\n"
+           << "Functions: " << H.Num_Functions << ", Instructions: " << Total << ", Threads: " << H.Num_Threads << "\n";
+        for (unsigned Op : Opcodes)
+            OS << format("  %12llu  %6.2f%%  %s\n", (unsigned long long)C.Counts[Op], percent(C.Counts[Op]),
+                         Instruction::getOpcodeName(Op));
+    }
+
+    // 报告写到 -opcode-histogram-file 指定的文件，没有指定时写到标准输出
+    void writeReport(function_ref<void(raw_ostream &)> Write)
+    {
+        if (HistogramFile.empty())
+        {
+            Write(outs());
+            return;
+        }
+        std::error_code EC;
+        raw_fd_ostream File(HistogramFile, EC, sys::fs::OF_Text);
+        if (EC)
+        {
+            errs() << "cannot open " << HistogramFile << ": " << EC.message() << "\n";
+            return;
+        }
+        Write(File);
+    }
+
+    void reportHistogram(const Module &M, const ModuleHistogram &H, Histogram_Format Format)
+    {
+        writeReport([&](raw_ostream &OS) { writeHistogram(OS, M, H, Format); });
+    }
+
+    // 估计的动态指令组成：每个基本块的操作码计数乘以该块的执行次数。
+    // 函数有入口计数（PGO 剖析数据或 !prof function_entry_count）时，块的执行次数是 BFI 据此换算出的计数；
+    // 否则是块频率与入口块频率之比，即函数每调用一次该块平均执行几次（循环次数来自 !prof 分支权重或静态启发式）。
+    // 两者单位不同（整个运行的次数 / 每次调用的次数），分成两组，各自求和、算百分比和排出最热的函数
+    enum Profile_Source
+    {
+        SOURCE_PROFILE,
+        SOURCE_FREQUENCY,
+        NUM_SOURCES
+    };
+
+    const char *const Source_Names[NUM_SOURCES] = {"profile", "frequency"};
+
+    struct FunctionProfile
+    {
+        std::string Name;
+        uint64_t Instructions = 0;
+        double Executed = 0;
+    };
+
+    struct ProfileGroup
+    {
+        OpcodeCounts Static;
+        double Executed[Instruction::OtherOpsEnd];
+        double Total = 0;
+        std::vector<FunctionProfile> Functions;
+
+        ProfileGroup() { std::fill(std::begin(Executed), std::end(Executed), 0.0); }
+    };
+
+    struct ModuleProfile
+    {
+        ProfileGroup Groups[NUM_SOURCES];
+
+        void add(Function &F, BlockFrequencyInfo &BFI)
+        {
+            bool From_Profile = F.getEntryCount().hasValue();
+            ProfileGroup &G = Groups[From_Profile ? SOURCE_PROFILE : SOURCE_FREQUENCY];
+            FunctionProfile FP;
+            FP.Name = F.getName().str();
+            double Entry_Freq = BFI.getEntryFreq();
+
+            for (BasicBlock &BB : F)
             {
-                for (BasicBlock::iterator i = bb->begin(); i != bb->end(); ++i)
+                double Weight = From_Profile ? BFI.getBlockProfileCount(&BB).getValueOr(0)
+                                             : BFI.getBlockFreq(&BB).getFrequency() / Entry_Freq;
+                for (Instruction &I : BB)
                 {
-                    if (opcodeCounter.find(i->getOpcodeName()) == opcodeCounter.end())
-                        opcodeCounter[i->getOpcodeName()] = 1;
-                    else
-                        opcodeCounter[i->getOpcodeName()]++;
+                    ++G.Static.Counts[I.getOpcode()];
+                    G.Executed[I.getOpcode()] += Weight;
                 }
+                FP.Instructions += BB.size();
+                FP.Executed += Weight * BB.size();
             }
+            G.Total += FP.Executed;
+            G.Functions.push_back(std::move(FP));
+        }
+    };
 
-            std::map<std::string, int>::iterator i = opcodeCounter.begin();
-            std::map<std::string, int>::iterator e = opcodeCounter.end();
-            while (i != e)
+    void writeGroupJSON(json::OStream &J, const ProfileGroup &G, unsigned Src, const std::vector<unsigned> &Opcodes,
+                        size_t Num_Hot)
+    {
+        J.attribute("functions", (int64_t)G.Functions.size());
+        J.attribute("instructions", (int64_t)G.Static.total());
+        J.attribute("estimated_executed", G.Total);
+        J.attribute("unit", Src == SOURCE_PROFILE ? "total" : "per_call");
+        J.attributeObject("opcodes", [&]
+                          {
+                              for (unsigned Op : Opcodes)
+                                  J.attributeObject(Instruction::getOpcodeName(Op), [&]
+                                                    {
+                                                        J.attribute("static", (int64_t)G.Static.Counts[Op]);
+                                                        J.attribute("estimated", G.Executed[Op]);
+                                                    });
+                          });
+        J.attributeArray("hottest_functions", [&]
+                         {
+                             for (size_t i = 0; i != Num_Hot; ++i)
+                                 J.object([&]
+                                          {
+                                              const FunctionProfile &FP = G.Functions[i];
+                                              J.attribute("name", FP.Name);
+                                              J.attribute("instructions", (int64_t)FP.Instructions);
+                                              J.attribute("estimated", FP.Executed);
+                                          });
+                         });
+    }
+
+    void writeProfile(raw_ostream &OS, const Module &M, ModuleProfile &P, Histogram_Format Format)
+    {
+        std::vector<unsigned> Opcodes[NUM_SOURCES];
+        size_t Num_Hot[NUM_SOURCES];
+        size_t Num_Functions = 0;
+        uint64_t Num_Instructions = 0;
+        for (unsigned Src = 0; Src != NUM_SOURCES; ++Src)
+        {
+            ProfileGroup &G = P.Groups[Src];
+            const double *E = G.Executed;
+            Opcodes[Src] = G.Static.opcodes([E](unsigned A, unsigned B)
+                                            { return E[A] != E[B] ? E[A] > E[B] : nameLess(A, B); });
+            std::stable_sort(G.Functions.begin(), G.Functions.end(), [](const FunctionProfile &A, const FunctionProfile &B)
+                             { return A.Executed > B.Executed; });
+            Num_Hot[Src] = std::min<size_t>(ProfileFunctions, G.Functions.size());
+            Num_Functions += G.Functions.size();
+            Num_Instructions += G.Static.total();
+        }
+        auto percent = [](const ProfileGroup &G, double N) { return G.Total ? N * 100.0 / G.Total : 0.0; };
+
+        if (Format == HISTOGRAM_JSON)
+        {
+            json::OStream J(OS, 2);
+            J.object([&]
+                     {
+                         J.attribute("module", M.getModuleIdentifier());
+                         J.attribute("functions", (int64_t)Num_Functions);
+                         J.attribute("profiled_functions", (int64_t)P.Groups[SOURCE_PROFILE].Functions.size());
+                         J.attribute("instructions", (int64_t)Num_Instructions);
+                         // 两组都输出（没有函数时为空），字段固定
+                         J.attributeObject("groups", [&]
+                                           {
+                                               for (unsigned Src = 0; Src != NUM_SOURCES; ++Src)
+                                                   J.attributeObject(Source_Names[Src], [&]
+                                                                     { writeGroupJSON(J, P.Groups[Src], Src,
+                                                                                      Opcodes[Src], Num_Hot[Src]); });
+                                           });
+                     });
+            OS << "\n";
+            return;
+        }
+
+        if (Format == HISTOGRAM_CSV)
+        {
+            // 百分比是占本组（source 列）估计总数的比例
+            OS << "source,kind,name,static,estimated,percent\n";
+            for (unsigned Src = 0; Src != NUM_SOURCES; ++Src)
+            {
+                const ProfileGroup &G = P.Groups[Src];
+                for (unsigned Op : Opcodes[Src])
+                    OS << Source_Names[Src] << ",opcode," << Instruction::getOpcodeName(Op) << ","
+                       << G.Static.Counts[Op] << "," << format("%.1f,%.3f", G.Executed[Op], percent(G, G.Executed[Op]))
+                       << "\n";
+                for (size_t i = 0; i != Num_Hot[Src]; ++i)
+                {
+                    const FunctionProfile &FP = G.Functions[i];
+                    OS << Source_Names[Src] << ",function," << FP.Name << "," << FP.Instructions << ","
+                       << format("%.1f,%.3f", FP.Executed, percent(G, FP.Executed)) << "\n";
+                }
+            }
+            return;
+        }
+
+        OS << "Module: " << M.getModuleIdentifier() << "\n"
+           << "Functions: " << Num_Functions << " (" << P.Groups[SOURCE_PROFILE].Functions.size()
+           << " with profile counts), Instructions: " << Num_Instructions << "\n";
+        for (unsigned Src = 0; Src != NUM_SOURCES; ++Src)
+        {
+            const ProfileGroup &G = P.Groups[Src];
+            if (G.Functions.empty())
+                continue;
+            OS << "\n"
+               << (Src == SOURCE_PROFILE ? "Functions with profile counts" : "Functions without profile counts")
+               << ": " << G.Functions.size() << ", Instructions: " << G.Static.total()
+               << format(Src == SOURCE_PROFILE ? ", Estimated executed: %.0f\n"
+                                               : ", Estimated executed per call (summed over functions): %.0f\n",
+                         G.Total)
+               << "       Estimated       %        Static  Opcode\n";
+            for (unsigned Op : Opcodes[Src])
+                OS << format("  %14.1f  %6.2f%%  %12llu  %s\n", G.Executed[Op], percent(G, G.Executed[Op]),
+                             (unsigned long long)G.Static.Counts[Op], Instruction::getOpcodeName(Op));
+            OS << "Hottest functions:\n"
+               << "       Estimated       %  Instructions  Function\n";
+            for (size_t i = 0; i != Num_Hot[Src]; ++i)
             {
-                outs() << i->first << ": " << i->second << "\n";
-                ++i;
+                const FunctionProfile &FP = G.Functions[i];
+                OS << format("  %14.1f  %6.2f%%  %12llu  ", FP.Executed, percent(G, FP.Executed),
+                             (unsigned long long)FP.Instructions)
+                   << FP.Name << "\n";
             }
+        }
+    }
+
+    void reportProfile(const Module &M, ModuleProfile &P, Histogram_Format Format)
+    {
+        writeReport([&](raw_ostream &OS) { writeProfile(OS, M, P, Format); });
+    }
+
+    // 老的 pass 管理器：opt -load ... -opcodeCounter
+    struct CountOpcode : public FunctionPass
+    {
+        static char ID;
+        CountOpcode() : FunctionPass(ID) {}
+
+        virtual bool runOnFunction(Function &F) override
+        {
+            printOpcodes(F.getName(), countOpcodes(F));
+            return false;
+        }
+    };
+
+    // opt -load ... -opcode-histogram
+    struct CountOpcodeModule : public ModulePass
+    {
+        static char ID;
+        CountOpcodeModule() : ModulePass(ID) {}
 
-            outs() << "\n";
-            opcodeCounter.clear();
+        bool runOnModule(Module &M) override
+        {
+            reportHistogram(M, countModule(M), HistogramFormat);
             return false;
         }
+
+        void getAnalysisUsage(AnalysisUsage &AU) const override { AU.setPreservesAll(); }
     };
+
+    // opt -load ... -opcode-profile
+    struct CountOpcodeProfile : public ModulePass
+    {
+        static char ID;
+        CountOpcodeProfile() : ModulePass(ID) {}
+
+        bool runOnModule(Module &M) override
+        {
+            ModuleProfile P;
+            for (Function &F : M)
+                if (!F.isDeclaration())
+                    P.add(F, getAnalysis<BlockFrequencyInfoWrapperPass>(F).getBFI());
+            reportProfile(M, P, HistogramFormat);
+            return false;
+        }
+
+        void getAnalysisUsage(AnalysisUsage &AU) const override
+        {
+            AU.addRequired<BlockFrequencyInfoWrapperPass>();
+            AU.setPreservesAll();
+        }
+    };
+
+    // 新的 pass 管理器：计数是一个分析，结果缓存在 FunctionAnalysisManager 中，
+    // 函数没有被改动时再次请求直接返回缓存
+    struct OpcodeCounterAnalysis : public AnalysisInfoMixin<OpcodeCounterAnalysis>
+    {
+        typedef OpcodeCounts Result;
+        Result run(Function &F, FunctionAnalysisManager &) { return countOpcodes(F); }
+
+    private:
+        friend AnalysisInfoMixin<OpcodeCounterAnalysis>;
+        static AnalysisKey Key;
+    };
+
+    AnalysisKey OpcodeCounterAnalysis::Key;
+
+    // opt -load-pass-plugin ... -passes=opcode-counter
+    struct OpcodeCounterPrinter : public PassInfoMixin<OpcodeCounterPrinter>
+    {
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM)
+        {
+            printOpcodes(F.getName(), FAM.getResult<OpcodeCounterAnalysis>(F));
+            return PreservedAnalyses::all();
+        }
+
+        // optnone 的函数也要统计
+        static bool isRequired() { return true; }
+    };
+
+    // opt -load-pass-plugin ... -passes='opcode-histogram<json>'
+    // 直接在线程中遍历 IR，不经过 FunctionAnalysisManager（它不能被多个线程同时使用）
+    struct OpcodeHistogramPrinter : public PassInfoMixin<OpcodeHistogramPrinter>
+    {
+        Histogram_Format Format;
+        OpcodeHistogramPrinter(Histogram_Format Format) : Format(Format) {}
+
+        PreservedAnalyses run(Module &M, ModuleAnalysisManager &)
+        {
+            reportHistogram(M, countModule(M), Format);
+            return PreservedAnalyses::all();
+        }
+
+        static bool isRequired() { return true; }
+    };
+
+    // opt -load-pass-plugin ... -passes='opcode-profile<json>'
+    // BlockFrequencyInfo 从 FunctionAnalysisManager 取，已经算过的函数直接用缓存
+    struct OpcodeProfilePrinter : public PassInfoMixin<OpcodeProfilePrinter>
+    {
+        Histogram_Format Format;
+        OpcodeProfilePrinter(Histogram_Format Format) : Format(Format) {}
+
+        PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM)
+        {
+            FunctionAnalysisManager &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+            ModuleProfile P;
+            for (Function &F : M)
+                if (!F.isDeclaration())
+                    P.add(F, FAM.getResult<BlockFrequencyAnalysis>(F));
+            reportProfile(M, P, Format);
+            return PreservedAnalyses::all();
+        }
+
+        static bool isRequired() { return true; }
+    };
+
+    // opcode-histogram、opcode-histogram<text|json|csv> 这样的 pass 名字，没有参数时用 -opcode-histogram-format
+    bool parseReportPass(StringRef Name, StringRef Pass, Histogram_Format &Format)
+    {
+        if (!Name.consume_front(Pass))
+            return false;
+        if (Name.empty())
+            Format = HistogramFormat;
+        else if (Name == "<text>")
+            Format = HISTOGRAM_TEXT;
+        else if (Name == "<json>")
+            Format = HISTOGRAM_JSON;
+        else if (Name == "<csv>")
+            Format = HISTOGRAM_CSV;
+        else
+            return false;
+        return true;
+    }
 }
 
 char CountOpcode::ID = 0;
-static RegisterPass<CountOpcode> X("opcodeCounter", "Count LLVM IR Opcodes", false, false);
\ No newline at end of file
+static RegisterPass<CountOpcode> X("opcodeCounter", "Count LLVM IR Opcodes", false, false);
+
+char CountOpcodeModule::ID = 0;
+static RegisterPass<CountOpcodeModule> Y("opcode-histogram", "Module-wide LLVM IR opcode histogram", false, true);
+
+char CountOpcodeProfile::ID = 0;
+static RegisterPass<CountOpcodeProfile> Z("opcode-profile", "Block-frequency-weighted LLVM IR opcode profile", false,
+                                          true);
+
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo()
+{
+    return {LLVM_PLUGIN_API_VERSION, "OpcodeCounter", LLVM_VERSION_STRING, [](PassBuilder &PB)
+            {
+                PB.registerAnalysisRegistrationCallback([](FunctionAnalysisManager &FAM)
+                                                        { FAM.registerPass([] { return OpcodeCounterAnalysis(); }); });
+                PB.registerPipelineParsingCallback(
+                    [](StringRef Name, FunctionPassManager &FPM, ArrayRef<PassBuilder::PipelineElement>)
+                    {
+                        if (Name != "opcode-counter")
+                            return false;
+                        FPM.addPass(OpcodeCounterPrinter());
+                        return true;
+                    });
+                // 插件里的 cl::opt 要另外 -load 才能在命令行上识别，报告格式因此也可以写成 pass 参数
+                PB.registerPipelineParsingCallback(
+                    [](StringRef Name, ModulePassManager &MPM, ArrayRef<PassBuilder::PipelineElement>)
+                    {
+                        Histogram_Format Format;
+                        if (parseReportPass(Name, "opcode-histogram", Format))
+                            MPM.addPass(OpcodeHistogramPrinter(Format));
+                        else if (parseReportPass(Name, "opcode-profile", Format))
+                            MPM.addPass(OpcodeProfilePrinter(Format));
+                        else
+                            return false;
+                        return true;
+                    });
+            }};
+}
@@ -1,5 +1,8 @@
 #include "llvm/Pass.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Analysis/LoopInfo.h"
 
@@ -7,46 +10,79 @@ using namespace llvm;
 
 namespace
 {
-    struct FuncBlcokCount : public FunctionPass
+    void countBlockInLoop(Loop *const L, unsigned nest)
     {
-        static char ID;
-        FuncBlcokCount() : FunctionPass(ID) {}
+        unsigned num_Blocks = 0;
+        Loop::block_iterator bb;
 
-        bool runOnFunction(Function &F) override
-        {
-            LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+        for (bb = L->block_begin(); bb != L->block_end(); ++bb)
+            num_Blocks++;
 
-            errs() << "Function: " << F.getName() << "\n";
+        errs() << "Loop nest level: " << nest << ", Number of blocks: " << num_Blocks << "\n";
 
-            for (Loop *const L : LI)
-                countBlockInLoop(L, 0);
+        std::vector<Loop *> subLoops = L->getSubLoops();
 
-            return false; // Continue analyzing other functions
-        }
+        Loop::iterator j;
+        for (j = subLoops.begin(); j != subLoops.end(); ++j)
+            countBlockInLoop(*j, nest + 1);
+    }
 
-        void countBlockInLoop(Loop *const L, unsigned nest)
-        {
-            unsigned num_Blocks = 0;
-            Loop::block_iterator bb;
+    void countBlocks(Function &F, LoopInfo &LI)
+    {
+        errs() << "Function: " << F.getName() << "\n";
 
-            for (bb = L->block_begin(); bb != L->block_end(); ++bb)
-                num_Blocks++;
+        for (Loop *const L : LI)
+            countBlockInLoop(L, 0);
+    }
 
-            errs() << "Loop nest level: " << nest << ", Number of blocks: " << num_Blocks << "\n";
+    // 老的 pass 管理器：opt -load ... -func-block-count
+    struct FuncBlcokCount : public FunctionPass
+    {
+        static char ID;
+        FuncBlcokCount() : FunctionPass(ID) {}
 
-            std::vector<Loop *> subLoops = L->getSubLoops();
+        bool runOnFunction(Function &F) override
+        {
+            countBlocks(F, getAnalysis<LoopInfoWrapperPass>().getLoopInfo());
 
-            Loop::iterator j;
-            for (j = subLoops.begin(); j != subLoops.end(); ++j)
-                countBlockInLoop(*j, nest + 1);
+            return false; // Continue analyzing other functions
         }
 
         virtual void getAnalysisUsage(AnalysisUsage &AU) const override
         {
             AU.addRequired<LoopInfoWrapperPass>();
+            AU.setPreservesAll();
+        }
+    };
+
+    // 新的 pass 管理器：opt -load-pass-plugin ... -passes=func-block-count
+    // LoopInfo 从 FunctionAnalysisManager 取，后面的 pass 只要没有改 CFG 就能继续用缓存的结果
+    struct FuncBlockCountPass : public PassInfoMixin<FuncBlockCountPass>
+    {
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM)
+        {
+            countBlocks(F, FAM.getResult<LoopAnalysis>(F));
+            return PreservedAnalyses::all();
         }
+
+        static bool isRequired() { return true; }
     };
 }
 
 char FuncBlcokCount::ID = 0;
-static RegisterPass<FuncBlcokCount> X("func-block-count", "Function Count Pass", false, false);
\ No newline at end of file
+static RegisterPass<FuncBlcokCount> X("func-block-count", "Function Count Pass", false, false);
+
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo()
+{
+    return {LLVM_PLUGIN_API_VERSION, "FuncBlockCount", LLVM_VERSION_STRING, [](PassBuilder &PB)
+            {
+                PB.registerPipelineParsingCallback(
+                    [](StringRef Name, FunctionPassManager &FPM, ArrayRef<PassBuilder::PipelineElement>)
+                    {
+                        if (Name != "func-block-count")
+                            return false;
+                        FPM.addPass(FuncBlockCountPass());
+                        return true;
+                    });
+            }};
+}
@@ -1,8 +1,20 @@
 #include "llvm/Pass.h"
 #include "llvm/IR/Function.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Transforms/Scalar.h"
+// 在 LLVM 源码树中编译时改为 "llvm/Transforms/Scalar/FuncBlockCount.h"
+#include "FuncBlockCount.h"
+
+namespace llvm
+{
+    // 在 LLVM 源码树中编译时由 InitializePasses.h 和 Transforms/Scalar.h 声明，单独编译成插件时在这里声明
+    void initializeFuncBlockCountPass(PassRegistry &);
+    Pass *createFuncBlockCountPass();
+}
 
 using namespace llvm;
 
@@ -10,55 +22,92 @@ using namespace llvm;
 
 namespace
 {
-    struct FuncBlcokCount : public FunctionPass
+    void countBlockInLoop(Loop *const L, unsigned nest)
     {
-        static char ID;
-        FuncBlcokCount() : FunctionPass(ID)
-        {
-            initializeFuncBlockCountPass(*PassRegistry::getPassRegistry());
-        }
+        unsigned num_Blocks = 0;
+        Loop::block_iterator bb;
 
-        bool runOnFunction(Function &F) override
-        {
-            LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+        for (bb = L->block_begin(); bb != L->block_end(); ++bb)
+            num_Blocks++;
 
-            errs() << "Function: " << F.getName() << "\n";
+        errs() << "Loop nest level: " << nest << ", Number of blocks: " << num_Blocks << "\n";
 
-            for (Loop *const L : LI)
-                countBlockInLoop(L, 0);
+        std::vector<Loop *> subLoops = L->getSubLoops();
 
-            return false; // Continue analyzing other functions
-        }
+        Loop::iterator j;
+        for (j = subLoops.begin(); j != subLoops.end(); ++j)
+            countBlockInLoop(*j, nest + 1);
+    }
 
-        void countBlockInLoop(Loop *const L, unsigned nest)
-        {
-            unsigned num_Blocks = 0;
-            Loop::block_iterator bb;
+    void countBlocks(Function &F, LoopInfo &LI)
+    {
+        errs() << "Function: " << F.getName() << "\n";
 
-            for (bb = L->block_begin(); bb != L->block_end(); ++bb)
-                num_Blocks++;
+        for (Loop *const L : LI)
+            countBlockInLoop(L, 0);
+    }
 
-            errs() << "Loop nest level: " << nest << ", Number of blocks: " << num_Blocks << "\n";
+    struct FuncBlockCount : public FunctionPass
+    {
+        static char ID;
+        FuncBlockCount() : FunctionPass(ID)
+        {
+            initializeFuncBlockCountPass(*PassRegistry::getPassRegistry());
+        }
 
-            std::vector<Loop *> subLoops = L->getSubLoops();
+        bool runOnFunction(Function &F) override
+        {
+            countBlocks(F, getAnalysis<LoopInfoWrapperPass>().getLoopInfo());
 
-            Loop::iterator j;
-            for (j = subLoops.begin(); j != subLoops.end(); ++j)
-                countBlockInLoop(*j, nest + 1);
+            return false; // Continue analyzing other functions
         }
 
         virtual void getAnalysisUsage(AnalysisUsage &AU) const override
         {
             AU.addRequired<LoopInfoWrapperPass>();
+            AU.setPreservesAll();
         }
     };
 }
 
-INITIALIZE_PASS_BEGIN(FuncBlcokCount, "func-block-count", "Function Block Count Pass", false, false)
+// 新的 pass 管理器：LoopInfo 由 FunctionAnalysisManager 缓存，不修改 IR，所有分析都保留
+PreservedAnalyses FuncBlockCountPass::run(Function &F, FunctionAnalysisManager &FAM)
+{
+    countBlocks(F, FAM.getResult<LoopAnalysis>(F));
+    return PreservedAnalyses::all();
+}
+
+char FuncBlockCount::ID = 0;
+
+INITIALIZE_PASS_BEGIN(FuncBlockCount, "func-block-count", "Function Block Count Pass", false, false)
 INITIALIZE_PASS_DEPENDENCY(LoopInfoWrapperPass)
-INITIALIZE_PASS_END(FuncBlcokCount, "func-block-count", "Function Block Count Pass", false, false)
+INITIALIZE_PASS_END(FuncBlockCount, "func-block-count", "Function Block Count Pass", false, false)
+
+Pass *llvm::createFuncBlockCountPass() { return new FuncBlockCount(); }
 
-Pass *llvm::createFuncBlcokCountPass() { return new FuncBlcokCount(); }
+// static RegisterPass<FuncBlockCount> X("func-block-count", "Function Count Pass", false, false);
+
+// 作为插件由 opt -load 加载时没有人调用 initializeFuncBlockCountPass，在库加载时注册
+namespace
+{
+    struct FuncBlockCountRegistration
+    {
+        FuncBlockCountRegistration() { initializeFuncBlockCountPass(*PassRegistry::getPassRegistry()); }
+    } Registration;
+}
 
-char FuncBlcokCount::ID = 0;
-// static RegisterPass<FuncBlcokCount> X("func-block-count", "Function Count Pass", false, false);
\ No newline at end of file
+// 单独编译成插件时：opt -load-pass-plugin ... -passes=func-block-count
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo()
+{
+    return {LLVM_PLUGIN_API_VERSION, "FuncBlockCount", LLVM_VERSION_STRING, [](PassBuilder &PB)
+            {
+                PB.registerPipelineParsingCallback(
+                    [](StringRef Name, FunctionPassManager &FPM, ArrayRef<PassBuilder::PipelineElement>)
+                    {
+                        if (Name != "func-block-count")
+                            return false;
+                        FPM.addPass(FuncBlockCountPass());
+                        return true;
+                    });
+            }};
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+// 新的 pass 管理器版本的 FuncBlockCount，放到 llvm 源码树的
+// include/llvm/Transforms/Scalar/FuncBlockCount.h，由 lib/Passes/PassBuilder.cpp 包含
+#ifndef LLVM_TRANSFORMS_SCALAR_FUNCBLOCKCOUNT_H
+#define LLVM_TRANSFORMS_SCALAR_FUNCBLOCKCOUNT_H
+
+#include "llvm/IR/PassManager.h"
+
+namespace llvm
+{
+    class Function;
+
+    struct FuncBlockCountPass : public PassInfoMixin<FuncBlockCountPass>
+    {
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM);
+        static bool isRequired() { return true; }
+    };
+}
+
+#endif
@@ -1,17 +1,43 @@
 #include "llvm/Transforms/Scalar.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/IteratedDominanceFrontier.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/InitializePasses.h"
 #include "llvm/Pass.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+#define DEBUG_TYPE "myadce"
+
+STATISTIC(NumRemoved, "Number of instructions removed");
+STATISTIC(NumBranchesRemoved, "Number of conditional branches folded");
+STATISTIC(NumLoopsKept, "Number of side-effect-free loops kept because they may not terminate");
+
+// 打开后条件分支不再一律保留：只有活跃指令控制依赖于它时才是活跃的，
+// 死的条件分支改为无条件跳转，由此变得不可达的块（包括空的死循环）一并删除
+static llvm::cl::opt<bool> RemoveControlFlow("myadce-remove-control-flow", llvm::cl::init(false),
+                                             llvm::cl::desc("Use control dependence to remove dead branches and loops"));
 
 namespace llvm
 {
+    // 在 LLVM 源码树中编译时由 InitializePasses.h 声明，单独编译成插件时在这里声明
+    void initializeMYADCEPass(PassRegistry &);
+
     struct MYADCE : public FunctionPass
     {
         static char ID;
@@ -24,10 +50,342 @@ namespace llvm
 
         void getAnalysisUsage(AnalysisUsage &AU) const override
         {
-            AU.setPreservesCFG();
+            if (RemoveControlFlow)
+            {
+                AU.addRequired<PostDominatorTreeWrapperPass>();
+                AU.addRequired<LoopInfoWrapperPass>();
+                AU.addRequired<ScalarEvolutionWrapperPass>();
+            }
+            else
+                AU.setPreservesCFG();
         }
     };
+
+    // 新的 pass 管理器：opt -load-pass-plugin ... -passes=myadce 或 -passes='myadce<remove-control-flow>'
+    // （opt 在解析完命令行之后才加载 -load-pass-plugin，插件里的 cl::opt 要再用 -load 加载一次才能识别）
+    struct MYADCEPass : public PassInfoMixin<MYADCEPass>
+    {
+        bool Remove_Control_Flow;
+        MYADCEPass(bool Remove_Control_Flow = RemoveControlFlow) : Remove_Control_Flow(Remove_Control_Flow) {}
+
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM);
+    };
+}
+
+using namespace llvm;
+
+namespace
+{
+    // 一次运行的状态。PDT 为空时只删除指令，否则按控制依赖删除死的分支和循环。
+    // 函数没有 mustprogress 时 LI/SE 不为空，用来判断哪些循环一定结束、可以删除
+    class DeadCodeEliminator
+    {
+        Function &F;
+        PostDominatorTree *PDT;
+        LoopInfo *LI;
+        ScalarEvolution *SE;
+
+        SmallPtrSet<Instruction *, 32> Alive;
+        SmallVector<Instruction *, 128> Worklist;
+        // 控制流是否到达这些块会影响结果：块中有活跃指令，或者是活跃 phi 的前驱；
+        // 它们控制依赖的条件分支（反向支配边界）因此是活跃的
+        SmallPtrSet<BasicBlock *, 32> CF_Live;
+        SmallVector<BasicBlock *, 32> New_CF_Live;
+        bool CFG_Changed = false;
+
+        bool isAlwaysLive(Instruction &I) const;
+        bool isFiniteLoop(Loop *L) const;
+        void markLoopsThatMayNotTerminate();
+        void markLive(Instruction *I);
+        void markCFLive(BasicBlock *BB);
+        void markControlDependences();
+        BasicBlock *pickSuccessor(BasicBlock *BB, const DenseMap<BasicBlock *, unsigned> &Post_Order) const;
+        bool removeDeadBranches();
+        void removeUnreachableBlocks();
+
+    public:
+        DeadCodeEliminator(Function &F, PostDominatorTree *PDT, LoopInfo *LI = nullptr, ScalarEvolution *SE = nullptr)
+            : F(F), PDT(PDT), LI(LI), SE(SE)
+        {
+        }
+        bool run();
+        // run 是否改动了 CFG（删除了分支或块），决定新 pass 管理器中 CFG 相关的分析能否保留
+        bool changedCFG() const { return CFG_Changed; }
+    };
+}
+
+// 一定要保留的指令：终结指令、异常处理入口、调试信息，以及写内存或可能抛出异常的指令
+// （包括调用非 readonly 的函数）。只读且 nounwind 的调用（如 strlen）结果不用时可以删除，
+// 这与 LLVM 9 的 mayHaveSideEffects 一致；LLVM 12 起它还要求 willreturn，自带的 -adce 会保留这类调用。
+// 删除控制流时 br 不是根：条件分支由控制依赖决定是否活跃，无条件分支只是保留下来。
+bool DeadCodeEliminator::isAlwaysLive(Instruction &I) const
+{
+    if (PDT && isa<BranchInst>(I))
+        return false;
+    return I.isTerminator() || I.isEHPad() || isa<DbgInfoIntrinsic>(I) || I.mayWriteToMemory() || I.mayThrow();
+}
+
+void DeadCodeEliminator::markLive(Instruction *I)
+{
+    if (Alive.insert(I).second)
+        Worklist.push_back(I);
+}
+
+void DeadCodeEliminator::markCFLive(BasicBlock *BB)
+{
+    if (CF_Live.insert(BB).second)
+        New_CF_Live.push_back(BB);
+}
+
+// 最大执行次数是常量，或者是简化形式的循环并且回边执行次数可以算出来，循环一定结束
+bool DeadCodeEliminator::isFiniteLoop(Loop *L) const
+{
+    if (SE->getSmallConstantMaxTripCount(L))
+        return true;
+    return L->isLoopSimplifyForm() && !isa<SCEVCouldNotCompute>(SE->getBackedgeTakenCount(L));
+}
+
+// 没有 mustprogress 时（C 等语言），不结束的循环即使没有副作用也是可观察的行为，删掉会让程序结束。
+// 不能证明会结束的循环，把它的退出分支和回边分支作为活跃的根，整个循环保留下来
+void DeadCodeEliminator::markLoopsThatMayNotTerminate()
+{
+    for (Loop *L : LI->getLoopsInPreorder())
+    {
+        if (isFiniteLoop(L))
+            continue;
+        ++NumLoopsKept;
+        for (BasicBlock *BB : L->blocks())
+            if (L->isLoopExiting(BB) || L->isLoopLatch(BB))
+                markLive(BB->getTerminator());
+    }
+}
+
+// 新加入 CF_Live 的块的迭代反向支配边界就是它们控制依赖的块，这些块的条件分支是活跃的
+void DeadCodeEliminator::markControlDependences()
+{
+    SmallPtrSet<BasicBlock *, 32> Blocks(New_CF_Live.begin(), New_CF_Live.end());
+    New_CF_Live.clear();
+
+    ReverseIDFCalculator IDFs(*PDT);
+    IDFs.setDefiningBlocks(Blocks);
+    SmallVector<BasicBlock *, 32> Controlling;
+    IDFs.calculate(Controlling);
+    for (BasicBlock *BB : Controlling)
+        markLive(BB->getTerminator());
+}
+
+// 先假定所有指令都是死的，从活跃的根出发沿操作数用工作表传播活跃性，
+// 每条指令最多入表一次、每个操作数最多检查一次，时间与函数大小成线性。
+bool DeadCodeEliminator::run()
+{
+    for (Instruction &I : instructions(F))
+        if (isAlwaysLive(I))
+            markLive(&I);
+
+    if (PDT)
+    {
+        // 到不了 ret 的块（无限循环等）不能改动控制流，它们的终结指令都保留
+        for (DomTreeNode *Root : children<DomTreeNode *>(PDT->getRootNode()))
+        {
+            if (isa<ReturnInst>(Root->getBlock()->getTerminator()))
+                continue;
+            for (DomTreeNode *Node : depth_first(Root))
+                markLive(Node->getBlock()->getTerminator());
+        }
+        if (LI)
+            markLoopsThatMayNotTerminate();
+    }
+
+    do
+    {
+        while (!Worklist.empty())
+        {
+            Instruction *Curr = Worklist.pop_back_val();
+            if (PDT)
+            {
+                markCFLive(Curr->getParent());
+                // phi 的值取决于从哪条边进来，前驱的控制流同样要保留
+                if (PHINode *PN = dyn_cast<PHINode>(Curr))
+                    for (BasicBlock *Pred : PN->blocks())
+                        markCFLive(Pred);
+            }
+            for (Use &OI : Curr->operands())
+                if (Instruction *Inst = dyn_cast<Instruction>(OI))
+                    markLive(Inst);
+        }
+        if (PDT && !New_CF_Live.empty())
+            markControlDependences();
+    } while (!Worklist.empty());
+
+    CFG_Changed = PDT && removeDeadBranches();
+
+    // 死指令之间可能互相引用（如循环中的 phi），先全部断开引用再删除；
+    // 删除控制流时未标记的无条件分支仍然保留
+    for (Instruction &I : instructions(F))
+        if (!Alive.count(&I) && !I.isTerminator())
+        {
+            Worklist.push_back(&I);
+            I.dropAllReferences();
+        }
+
+    for (Instruction *I : Worklist)
+    {
+        ++NumRemoved;
+        I->eraseFromParent();
+    }
+
+    if (CFG_Changed)
+        removeUnreachableBlocks();
+    return CFG_Changed || !Worklist.empty();
+}
+
+// 死的条件分支与它的直接后支配者之间只有死指令，走哪个后继都一样；
+// 选反向 CFG 后序编号最大（最靠近出口）的后继，保证改写后不会形成新的循环
+BasicBlock *DeadCodeEliminator::pickSuccessor(BasicBlock *BB,
+                                              const DenseMap<BasicBlock *, unsigned> &Post_Order) const
+{
+    BasicBlock *Preferred = nullptr;
+    unsigned Best = 0;
+    for (BasicBlock *Succ : successors(BB))
+    {
+        unsigned N = Post_Order.lookup(Succ);
+        if (!Preferred || N > Best)
+        {
+            Preferred = Succ;
+            Best = N;
+        }
+    }
+    return Preferred;
+}
+
+bool DeadCodeEliminator::removeDeadBranches()
+{
+    SmallVector<BranchInst *, 16> Dead_Branches;
+    for (BasicBlock &BB : F)
+        if (BranchInst *BI = dyn_cast<BranchInst>(BB.getTerminator()))
+            if (BI->isConditional() && !Alive.count(BI))
+                Dead_Branches.push_back(BI);
+    if (Dead_Branches.empty())
+        return false;
+
+    // 从每个没有后继的块出发沿反向 CFG 编后序号，编号从 1 开始，0 表示到不了出口
+    DenseMap<BasicBlock *, unsigned> Post_Order;
+    SmallPtrSet<BasicBlock *, 32> Visited;
+    unsigned N = 0;
+    for (BasicBlock &BB : F)
+        if (succ_empty(&BB))
+            for (BasicBlock *Block : inverse_post_order_ext(&BB, Visited))
+                Post_Order[Block] = ++N;
+
+    for (BranchInst *BI : Dead_Branches)
+    {
+        BasicBlock *BB = BI->getParent();
+        BasicBlock *Target = pickSuccessor(BB, Post_Order);
+        bool Kept = false;
+        for (BasicBlock *Succ : successors(BB))
+        {
+            if (Succ == Target && !Kept)
+                Kept = true;
+            else
+                Succ->removePredecessor(BB, /*KeepOneInputPHIs=*/true);
+        }
+        BranchInst::Create(Target, BI);
+        BI->eraseFromParent();
+        ++NumBranchesRemoved;
+    }
+    return true;
+}
+
+// 改写分支后不再可达的块（死循环的循环体等）。不用 Local.h 中的同名函数，它还会折叠常量条件的分支
+void DeadCodeEliminator::removeUnreachableBlocks()
+{
+    df_iterator_default_set<BasicBlock *, 32> Reachable;
+    for (BasicBlock *BB : depth_first_ext(&F.getEntryBlock(), Reachable))
+        (void)BB;
+
+    SmallVector<BasicBlock *, 16> Dead_Blocks;
+    for (BasicBlock &BB : F)
+        if (!Reachable.count(&BB))
+            Dead_Blocks.push_back(&BB);
+    DeleteDeadBlocks(Dead_Blocks);
+}
+
+bool MYADCE::runOnFunction(Function &F)
+{
+    if (skipFunction(F))
+        return false;
+
+    PostDominatorTree *PDT = nullptr;
+    LoopInfo *LI = nullptr;
+    ScalarEvolution *SE = nullptr;
+    if (RemoveControlFlow)
+    {
+        PDT = &getAnalysis<PostDominatorTreeWrapperPass>().getPostDomTree();
+        if (!F.mustProgress())
+        {
+            LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+            SE = &getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+        }
+    }
+    return DeadCodeEliminator(F, PDT, LI, SE).run();
+}
+
+// 没有改动时保留所有分析；只删除了指令时 CFG 不变，支配树、循环信息等仍然有效
+PreservedAnalyses MYADCEPass::run(Function &F, FunctionAnalysisManager &FAM)
+{
+    PostDominatorTree *PDT = nullptr;
+    LoopInfo *LI = nullptr;
+    ScalarEvolution *SE = nullptr;
+    if (Remove_Control_Flow)
+    {
+        PDT = &FAM.getResult<PostDominatorTreeAnalysis>(F);
+        if (!F.mustProgress())
+        {
+            LI = &FAM.getResult<LoopAnalysis>(F);
+            SE = &FAM.getResult<ScalarEvolutionAnalysis>(F);
+        }
+    }
+
+    DeadCodeEliminator Eliminator(F, PDT, LI, SE);
+    if (!Eliminator.run())
+        return PreservedAnalyses::all();
+
+    PreservedAnalyses PA;
+    if (!Eliminator.changedCFG())
+        PA.preserveSet<CFGAnalyses>();
+    return PA;
 }
 
 char MYADCE::ID = 0;
-INITIALIZE_PASS(MYADCE, "myadce", "My Advanced Dead Code Elimination", false, false);
\ No newline at end of file
+INITIALIZE_PASS_BEGIN(MYADCE, "myadce", "My Advanced Dead Code Elimination", false, false)
+INITIALIZE_PASS_DEPENDENCY(PostDominatorTreeWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(LoopInfoWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(ScalarEvolutionWrapperPass)
+INITIALIZE_PASS_END(MYADCE, "myadce", "My Advanced Dead Code Elimination", false, false)
+
+// 作为插件由 opt -load 加载时没有人调用 initializeMYADCEPass，在库加载时注册
+namespace
+{
+    struct MYADCERegistration
+    {
+        MYADCERegistration() { initializeMYADCEPass(*PassRegistry::getPassRegistry()); }
+    } Registration;
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo()
+{
+    return {LLVM_PLUGIN_API_VERSION, "MYADCE", LLVM_VERSION_STRING, [](PassBuilder &PB)
+            {
+                PB.registerPipelineParsingCallback(
+                    [](StringRef Name, FunctionPassManager &FPM, ArrayRef<PassBuilder::PipelineElement>)
+                    {
+                        if (Name == "myadce")
+                            FPM.addPass(MYADCEPass());
+                        else if (Name == "myadce<remove-control-flow>")
+                            FPM.addPass(MYADCEPass(true));
+                        else
+                            return false;
+                        return true;
+                    });
+            }};
+}
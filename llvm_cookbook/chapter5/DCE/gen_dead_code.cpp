@@ -0,0 +1,84 @@
+// 生成一个带大量死代码的大函数（文本 IR），作为 -myadce 与 -adce 的基准测试输入。
+//
+//   ./gen_dead_code -blocks=1000 -insts=100 -dead=50 > big.ll
+//   opt -load ./libmyadcelib.so -myadce -time-passes -disable-output big.ll
+//
+// 函数是一个循环：entry -> bb0 -> bb1 -> ... -> bbN-1 -> bb0 / exit。
+// 每个块里交替生成活跃链和死链上的算术指令：活跃链的值每块存到 %out 一次，最后作为返回值；
+// 死链从 bb0 的 phi 出发绕循环一圈又回到这个 phi，还夹杂着结果不用的 strlen 调用。
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+static llvm::cl::opt<unsigned> Num_Blocks("blocks", llvm::cl::init(100),
+                                          llvm::cl::desc("Number of basic blocks in the loop body"));
+static llvm::cl::opt<unsigned> Insts_Per_Block("insts", llvm::cl::init(100),
+                                               llvm::cl::desc("Arithmetic instructions per basic block"));
+static llvm::cl::opt<unsigned> Dead_Percent("dead", llvm::cl::init(50),
+                                            llvm::cl::desc("Percentage of the instructions that are dead"));
+
+int main(int argc, char *argv[])
+{
+    llvm::cl::ParseCommandLineOptions(argc, argv, "dead code benchmark generator\n");
+    if (Num_Blocks == 0 || Dead_Percent > 100)
+    {
+        llvm::errs() << "need -blocks >= 1 and -dead <= 100\n";
+        return 1;
+    }
+    llvm::raw_ostream &OS = llvm::outs();
+    static const char *Ops[] = {"add", "mul", "xor", "sub"};
+
+    OS << "declare i32 @strlen(i8*) readonly nounwind\n\n";
+    OS << "define i32 @big(i32 %n, i32* %out) {\n";
+    OS << "entry:\n  br label %bb0\n";
+
+    unsigned Last = Num_Blocks - 1;
+    for (unsigned b = 0; b != Num_Blocks; ++b)
+    {
+        OS << "bb" << b << ":\n";
+        // 每块的活跃值和死值分别从 %l<b>_0、%d<b>_0 开始
+        if (b == 0)
+        {
+            OS << "  %i = phi i32 [ 0, %entry ], [ %i.next, %bb" << Last << " ]\n";
+            OS << "  %l0_0 = phi i32 [ %n, %entry ], [ %l" << Last << "_end, %bb" << Last << " ]\n";
+            OS << "  %d0_0 = phi i32 [ %n, %entry ], [ %d" << Last << "_end, %bb" << Last << " ]\n";
+        }
+        else
+        {
+            OS << "  %l" << b << "_0 = add i32 %l" << b - 1 << "_end, 1\n";
+            OS << "  %d" << b << "_0 = add i32 %d" << b - 1 << "_end, 1\n";
+        }
+
+        // Bresenham 式地分配死指令，死指令比例在每块内都接近 -dead
+        unsigned L = 0, D = 0;
+        for (unsigned k = 0; k != Insts_Per_Block; ++k)
+        {
+            const char *Op = Ops[k % 4];
+            if ((k + 1) * Dead_Percent / 100 > k * Dead_Percent / 100)
+            {
+                if (k % 8 == 7)
+                    OS << "  %s" << b << "_" << k << " = call i32 @strlen(i8* null)\n";
+                OS << "  %d" << b << "_" << D + 1 << " = " << Op << " i32 %d" << b << "_" << D << ", " << k + 3 << "\n";
+                ++D;
+            }
+            else
+            {
+                OS << "  %l" << b << "_" << L + 1 << " = " << Op << " i32 %l" << b << "_" << L << ", " << k + 3 << "\n";
+                ++L;
+            }
+        }
+        OS << "  %l" << b << "_end = add i32 %l" << b << "_" << L << ", 0\n";
+        OS << "  %d" << b << "_end = add i32 %d" << b << "_" << D << ", 0\n";
+        OS << "  store i32 %l" << b << "_end, i32* %out\n";
+
+        if (b != Last)
+            OS << "  br label %bb" << b + 1 << "\n";
+        else
+        {
+            OS << "  %i.next = add i32 %i, 1\n";
+            OS << "  %cond = icmp slt i32 %i.next, %n\n";
+            OS << "  br i1 %cond, label %bb0, label %exit\n";
+        }
+    }
+    OS << "exit:\n  ret i32 %l" << Last << "_end\n}\n";
+    return 0;
+}
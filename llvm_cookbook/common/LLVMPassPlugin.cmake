@@ -0,0 +1,83 @@
+# chapter4/chapter5 的 pass 插件共用的构建设置，在 project() 之后 include，
+# 再对每个插件目标调用 add_llvm_pass_plugin_profile(<target>)。
+#
+#   cmake -S . -B build                                  默认 Release
+#   cmake -S . -B build -DCMAKE_BUILD_TYPE=Debug         Debug / RelWithDebInfo / MinSizeRel
+#   cmake -S . -B build -DPASS_LTO=ON                    链接时优化
+#   cmake -S . -B build -DPASS_PGO=generate              插桩构建，用 opt -load 跑一遍典型输入
+#   cmake -S . -B build -DPASS_PGO=use                   再用收集到的剖析数据重新构建
+#
+# LLVM 的查找顺序：-DLLVM_DIR=...；否则 PATH 中 llvm-config / llvm-config-14 的 --cmakedir。
+# 插件用到 LLVM 14 的接口（如 Function::mustProgress），更早的版本在配置时报错。
+
+set(LLVM_MIN_VERSION 14)
+
+if(NOT LLVM_DIR)
+    find_program(LLVM_CONFIG_EXECUTABLE NAMES llvm-config llvm-config-${LLVM_MIN_VERSION})
+    if(LLVM_CONFIG_EXECUTABLE)
+        execute_process(COMMAND ${LLVM_CONFIG_EXECUTABLE} --cmakedir
+                        OUTPUT_VARIABLE LLVM_CMAKE_DIR OUTPUT_STRIP_TRAILING_WHITESPACE)
+        set(LLVM_DIR ${LLVM_CMAKE_DIR} CACHE PATH "Directory containing LLVMConfig.cmake")
+    endif()
+endif()
+
+find_package(LLVM REQUIRED CONFIG)
+message(STATUS "Using LLVM ${LLVM_PACKAGE_VERSION} from ${LLVM_DIR}")
+if(LLVM_VERSION_MAJOR LESS LLVM_MIN_VERSION)
+    message(FATAL_ERROR "LLVM ${LLVM_PACKAGE_VERSION} is too old, LLVM ${LLVM_MIN_VERSION} or newer is required; "
+                        "set -DLLVM_DIR to its lib/cmake/llvm directory")
+endif()
+
+separate_arguments(LLVM_DEFINITIONS_LIST UNIX_COMMAND "${LLVM_DEFINITIONS}")
+add_definitions(${LLVM_DEFINITIONS_LIST})
+include_directories(${LLVM_INCLUDE_DIRS})
+
+set(CMAKE_CXX_STANDARD 14)
+set(CMAKE_CXX_STANDARD_REQUIRED ON)
+
+if(NOT CMAKE_BUILD_TYPE AND NOT CMAKE_CONFIGURATION_TYPES)
+    set(CMAKE_BUILD_TYPE Release CACHE STRING "Debug, Release, RelWithDebInfo or MinSizeRel" FORCE)
+endif()
+
+option(PASS_LTO "Build the pass plugins with link-time optimization" OFF)
+set(PASS_PGO "" CACHE STRING "Profile-guided optimization of the pass plugins: generate, use or empty")
+set(PASS_PGO_DIR "${CMAKE_BINARY_DIR}/pgo-data" CACHE PATH "Where the PGO profiles are written and read")
+
+if(PASS_LTO)
+    cmake_policy(SET CMP0069 NEW)
+    include(CheckIPOSupported)
+    check_ipo_supported(RESULT PASS_LTO_SUPPORTED OUTPUT PASS_LTO_ERROR)
+    if(NOT PASS_LTO_SUPPORTED)
+        message(WARNING "LTO is not supported: ${PASS_LTO_ERROR}")
+    endif()
+endif()
+
+# GCC 直接读写 .gcda；Clang 写 .profraw，用之前要 llvm-profdata merge -o ${PASS_PGO_DIR}/default.profdata
+if(PASS_PGO STREQUAL "generate")
+    set(PASS_PGO_FLAGS "-fprofile-generate=${PASS_PGO_DIR}")
+    if(CMAKE_CXX_COMPILER_ID STREQUAL "GNU")
+        set(PASS_PGO_FLAGS "${PASS_PGO_FLAGS} -fprofile-update=atomic")
+    endif()
+elseif(PASS_PGO STREQUAL "use")
+    if(CMAKE_CXX_COMPILER_ID STREQUAL "GNU")
+        set(PASS_PGO_FLAGS "-fprofile-use=${PASS_PGO_DIR} -fprofile-correction -Wno-missing-profile")
+    else()
+        set(PASS_PGO_FLAGS "-fprofile-use=${PASS_PGO_DIR}/default.profdata")
+    endif()
+elseif(PASS_PGO)
+    message(FATAL_ERROR "PASS_PGO must be generate, use or empty")
+endif()
+
+function(add_llvm_pass_plugin_profile Target)
+    # 与 LLVM 本身的 RTTI 设置一致，否则加载插件时找不到 typeinfo
+    if(NOT LLVM_ENABLE_RTTI)
+        target_compile_options(${Target} PRIVATE -fno-rtti)
+    endif()
+    if(PASS_LTO AND PASS_LTO_SUPPORTED)
+        set_property(TARGET ${Target} PROPERTY INTERPROCEDURAL_OPTIMIZATION TRUE)
+    endif()
+    if(PASS_PGO_FLAGS)
+        set_property(TARGET ${Target} APPEND_STRING PROPERTY COMPILE_FLAGS " ${PASS_PGO_FLAGS}")
+        set_property(TARGET ${Target} APPEND_STRING PROPERTY LINK_FLAGS " ${PASS_PGO_FLAGS}")
+    endif()
+endfunction()
@@ -0,0 +1,56 @@
+# toy 编译器共用的构建配置，由各章的 Makefile include
+#
+#   make                      默认 release（-O2）
+#   make BUILD=debug          -g -O0，方便调试
+#   make BUILD=relwithdebinfo -O2 带调试信息，用于 perf 等剖析工具
+#   make BUILD=lto            -O2 -flto
+#   make pgo                  先用 -fprofile-generate 构建并运行 PGO_TRAIN 收集剖析数据，再用 -fprofile-use 重新构建
+#                             （也可以分步：make BUILD=pgo-gen，运行训练，make BUILD=pgo-use）
+#
+# LLVM 通过 llvm-config 查找：默认依次尝试 PATH 中的 llvm-config、llvm-config-14，
+# 也可以 make LLVM_CONFIG=/path/to/llvm-config 指定。代码用到 LLVM 14 的接口
+# （llvm/MC/TargetRegistry.h、FixedVectorType、Function::mustProgress），更早的版本直接报错。
+
+LLVM_CONFIG ?= $(shell command -v llvm-config || command -v llvm-config-14)
+ifeq ($(LLVM_CONFIG),)
+$(error llvm-config not found, set LLVM_CONFIG=/path/to/llvm-config)
+endif
+
+LLVM_MIN_VERSION = 14
+LLVM_VERSION := $(shell $(LLVM_CONFIG) --version)
+ifneq ($(shell test '$(firstword $(subst ., ,$(LLVM_VERSION)))' -ge $(LLVM_MIN_VERSION) 2>/dev/null && echo ok),ok)
+$(error $(LLVM_CONFIG) is LLVM $(LLVM_VERSION), LLVM $(LLVM_MIN_VERSION) or newer is required; set LLVM_CONFIG=/path/to/llvm-config)
+endif
+
+BUILD ?= release
+PGO_DIR ?= pgo-data
+
+# LLVM 的 ABI 不受 NDEBUG 影响（由 llvm/Config/abi-breaking.h 固定），release 构建可以去掉 assert
+PROFILE_FLAGS_debug = -g -O0
+PROFILE_FLAGS_release = -O2 -DNDEBUG
+PROFILE_FLAGS_relwithdebinfo = -g -O2 -DNDEBUG
+PROFILE_FLAGS_lto = -O2 -DNDEBUG -flto=auto
+# -j 的工作线程也会更新计数器，用原子更新避免剖析数据损坏
+PROFILE_FLAGS_pgo-gen = -O2 -DNDEBUG -fprofile-generate=$(PGO_DIR) -fprofile-update=atomic
+PROFILE_FLAGS_pgo-use = -O2 -DNDEBUG -fprofile-use=$(PGO_DIR) -fprofile-correction -Wno-missing-profile
+
+PROFILE_FLAGS = $(PROFILE_FLAGS_$(BUILD))
+ifeq ($(PROFILE_FLAGS),)
+$(error unknown BUILD=$(BUILD), expected debug, release, relwithdebinfo, lto, pgo-gen or pgo-use)
+endif
+
+# 编译选项变化时更新这个文件，目标依赖它，切换 BUILD 后会自动重新编译。
+# 先比较内容，相同时不写，文件的修改时间不变，重复 make 不会重新链接
+PROFILE_STAMP = .build-profile
+PROFILE_STAMP_OLD := $(shell cat $(PROFILE_STAMP) 2>/dev/null)
+ifneq ($(strip $(PROFILE_STAMP_OLD)),$(strip $(PROFILE_FLAGS)))
+$(shell printf '%s\n' '$(strip $(PROFILE_FLAGS))' > $(PROFILE_STAMP))
+endif
+
+# 两阶段 PGO 的命令，各章的 Makefile 在 pgo 目标中使用，训练运行的命令放在 PGO_TRAIN 中
+define PGO_RECIPE
+rm -rf $(PGO_DIR)
+$(MAKE) BUILD=pgo-gen $(TARGET)
+$(PGO_TRAIN)
+$(MAKE) BUILD=pgo-use $(TARGET)
+endef